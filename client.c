@@ -0,0 +1,248 @@
+/*
+ * Outgoing connections with automatic reconnect
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+#include <fcntl.h>
+
+#include "common.h"
+#include "select.h"
+#include "uagent_debug.h"
+#include "client.h"
+
+enum client_state {
+	CLIENT_WAITING, /* for the reconnect delay */
+	CLIENT_CONNECTING, /* for the connect to complete */
+	CLIENT_CONNECTED
+};
+
+struct client {
+	char *name;
+	struct sockaddr_in addr;
+	int sock;
+	enum client_state state;
+	client_connected_cb connected;
+	client_disconnected_cb disconnected;
+	void *ctx;
+
+	/* Reconnect delay while waiting, connect timeout while connecting */
+	struct select_timeout timer;
+	unsigned int backoff_ms; /* upper limit of the next reconnect delay */
+	struct os_reltime up_since;
+	u32 rand; /* xorshift state for the jitter */
+};
+
+
+static void client_connect(struct client *cl);
+
+
+static u32 client_random(struct client *cl)
+{
+	u32 x = cl->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	cl->rand = x;
+	return x;
+}
+
+
+static void client_timeout(void *server_ctx, void *uagent_ctx)
+{
+	struct client *cl = server_ctx;
+
+	if (cl->state == CLIENT_CONNECTING) {
+		uagent_printf(MSG_ERROR, "client %s: connect timed out",
+			      cl->name);
+		select_unregister_sock(cl->sock, EVENT_TYPE_WRITE);
+		close(cl->sock);
+		cl->sock = -1;
+		cl->state = CLIENT_WAITING;
+	}
+	client_connect(cl);
+}
+
+
+/*
+ * Wait for a random delay between half and all of the current backoff, then
+ * double the backoff for the attempt after that
+ */
+static void client_schedule(struct client *cl)
+{
+	unsigned int delay;
+
+	delay = cl->backoff_ms / 2 + client_random(cl) % (cl->backoff_ms / 2 + 1);
+	cl->backoff_ms *= 2;
+	if (cl->backoff_ms > CLIENT_BACKOFF_MAX_MS)
+		cl->backoff_ms = CLIENT_BACKOFF_MAX_MS;
+
+	uagent_printf(MSG_INFO, "client %s: reconnecting in %u ms", cl->name,
+		      delay);
+	cl->state = CLIENT_WAITING;
+	select_timeout_arm(&cl->timer, delay / 1000, (delay % 1000) * 1000);
+}
+
+
+static void client_established(struct client *cl)
+{
+	select_timeout_disarm(&cl->timer);
+
+	uagent_printf(MSG_INFO, "client %s: connected", cl->name);
+	cl->state = CLIENT_CONNECTED;
+	os_get_reltime(&cl->up_since);
+	cl->connected(cl, cl->sock, cl->ctx);
+}
+
+
+static void client_connect_done(int sock, void *server_ctx, void *uagent_ctx)
+{
+	struct client *cl = server_ctx;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	select_unregister_sock(sock, EVENT_TYPE_WRITE);
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err) {
+		uagent_printf(MSG_ERROR, "client %s: connect: %s", cl->name,
+			      strerror(err));
+		select_timeout_disarm(&cl->timer);
+		close(sock);
+		cl->sock = -1;
+		client_schedule(cl);
+		return;
+	}
+	client_established(cl);
+}
+
+
+static void client_connect(struct client *cl)
+{
+	int sock;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		uagent_printf(MSG_ERROR, "client %s: socket: %s", cl->name,
+			      strerror(errno));
+		client_schedule(cl);
+		return;
+	}
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sock, F_SETFD, FD_CLOEXEC) < 0) {
+		uagent_printf(MSG_ERROR, "client %s: fcntl: %s", cl->name,
+			      strerror(errno));
+		close(sock);
+		client_schedule(cl);
+		return;
+	}
+	cl->sock = sock;
+
+	if (connect(sock, (struct sockaddr *) &cl->addr, sizeof(cl->addr)) ==
+	    0) {
+		client_established(cl);
+		return;
+	}
+	if (errno != EINPROGRESS) {
+		uagent_printf(MSG_ERROR, "client %s: connect: %s", cl->name,
+			      strerror(errno));
+		close(sock);
+		cl->sock = -1;
+		client_schedule(cl);
+		return;
+	}
+	if (select_register_sock(sock, EVENT_TYPE_WRITE, client_connect_done,
+				 cl, NULL) < 0) {
+		close(sock);
+		cl->sock = -1;
+		client_schedule(cl);
+		return;
+	}
+	cl->state = CLIENT_CONNECTING;
+	select_timeout_arm(&cl->timer, CLIENT_CONNECT_TIMEOUT_SECS, 0);
+}
+
+
+struct client * client_init(const char *name, const struct sockaddr_in *addr,
+			    client_connected_cb connected,
+			    client_disconnected_cb disconnected, void *ctx)
+{
+	struct client *cl;
+
+	cl = os_zalloc(sizeof(*cl));
+	if (cl == NULL)
+		return NULL;
+	cl->name = os_strdup(name);
+	if (cl->name == NULL) {
+		os_free(cl);
+		return NULL;
+	}
+	cl->addr = *addr;
+	cl->sock = -1;
+	cl->connected = connected;
+	cl->disconnected = disconnected;
+	cl->ctx = ctx;
+	cl->backoff_ms = CLIENT_BACKOFF_MIN_MS;
+	select_timeout_init(&cl->timer, client_timeout, cl, NULL);
+
+	/* Agents restarted together must not retry in lockstep */
+	if (os_get_random((u8 *) &cl->rand, sizeof(cl->rand)) < 0)
+		cl->rand = os_random() ^ getpid();
+	if (cl->rand == 0)
+		cl->rand = 1;
+
+	client_connect(cl);
+	return cl;
+}
+
+
+static void client_close(struct client *cl)
+{
+	if (cl->state == CLIENT_CONNECTED) {
+		if (cl->disconnected)
+			cl->disconnected(cl, cl->sock, cl->ctx);
+	} else if (cl->state == CLIENT_CONNECTING) {
+		select_unregister_sock(cl->sock, EVENT_TYPE_WRITE);
+	}
+	if (cl->sock >= 0)
+		close(cl->sock);
+	cl->sock = -1;
+}
+
+
+void client_deinit(struct client *cl)
+{
+	if (cl == NULL)
+		return;
+	select_timeout_disarm(&cl->timer);
+	client_close(cl);
+	os_free(cl->name);
+	os_free(cl);
+}
+
+
+void client_lost(struct client *cl)
+{
+	struct os_reltime now, up;
+
+	if (cl->state != CLIENT_CONNECTED)
+		return;
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &cl->up_since, &up);
+	uagent_printf(MSG_ERROR, "client %s: connection lost after %ld s",
+		      cl->name, (long) up.sec);
+	if (up.sec >= CLIENT_STABLE_SECS)
+		cl->backoff_ms = CLIENT_BACKOFF_MIN_MS;
+	client_close(cl);
+	client_schedule(cl);
+}
+
+
+int client_sock(const struct client *cl)
+{
+	return cl->state == CLIENT_CONNECTED ? cl->sock : -1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Outgoing connections with automatic reconnect
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines a connection manager for the TCP connections the agent
+ * opens to the servers. Connects are non-blocking and complete from the select
+ * loop, so a server that is down or slow to answer never stalls the agent.
+ * When a connect fails or an established connection is lost, the next attempt
+ * is scheduled with exponential backoff and random jitter, so that a fleet of
+ * agents does not hammer a server that is restarting all at the same moment.
+ */
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <netinet/in.h>
+
+struct client;
+
+/* Delay before the first reconnect, doubled after every failed attempt */
+#define CLIENT_BACKOFF_MIN_MS 500
+/* Upper limit of the reconnect delay */
+#define CLIENT_BACKOFF_MAX_MS 60000
+/* A connect that has not completed after this long is given up */
+#define CLIENT_CONNECT_TIMEOUT_SECS 10
+/*
+ * A connection that stayed up at least this long resets the backoff; one that
+ * is dropped sooner, e.g., by a server that accepts and closes right away,
+ * keeps backing off.
+ */
+#define CLIENT_STABLE_SECS 30
+
+/**
+ * client_connected_cb - Callback for an established connection
+ * @cl: Client from client_init()
+ * @sock: Connected socket in non-blocking mode, owned by the client
+ * @ctx: Callback context data from client_init()
+ *
+ * This is the place to register the read handler of the socket. It is called
+ * again with a new socket after every reconnect.
+ */
+typedef void (*client_connected_cb)(struct client *cl, int sock, void *ctx);
+
+/**
+ * client_disconnected_cb - Callback for a lost connection
+ * @cl: Client from client_init()
+ * @sock: Socket of the lost connection, closed right after the call
+ * @ctx: Callback context data from client_init()
+ *
+ * Handlers registered for the socket must be unregistered here.
+ */
+typedef void (*client_disconnected_cb)(struct client *cl, int sock,
+				       void *ctx);
+
+/**
+ * client_init - Start connecting to a server
+ * @name: Name of the connection for log messages
+ * @addr: Address of the server
+ * @connected: Callback for each established connection
+ * @disconnected: Callback for each lost connection or %NULL
+ * @ctx: Callback context data
+ * Returns: Pointer to the client or %NULL on failure
+ *
+ * The first connect is started right away. The client uses the select loop of
+ * the calling thread and must only be used from that thread.
+ */
+struct client * client_init(const char *name, const struct sockaddr_in *addr,
+			    client_connected_cb connected,
+			    client_disconnected_cb disconnected, void *ctx);
+
+/**
+ * client_deinit - Close the connection and stop reconnecting
+ * @cl: Client from client_init() or %NULL
+ *
+ * The disconnected callback is called if the connection is up.
+ */
+void client_deinit(struct client *cl);
+
+/**
+ * client_lost - Report that the connection has failed
+ * @cl: Client from client_init()
+ *
+ * To be called by the user of the connection on EOF or a socket error. The
+ * socket is closed after the disconnected callback and a reconnect is
+ * scheduled. Nothing is done if the connection is not up.
+ */
+void client_lost(struct client *cl);
+
+/**
+ * client_sock - Get the socket of the connection
+ * @cl: Client from client_init()
+ * Returns: Connected socket or -1 if the connection is not up
+ */
+int client_sock(const struct client *cl);
+
+#endif /* CLIENT_H */
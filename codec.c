@@ -0,0 +1,364 @@
+/*
+ * Message codec
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "codec.h"
+#include "server_cmd.h"
+
+/* Worst case size of a TLV: tag, length and value */
+#define CODEC_TLV_INT_MAX_LEN (2 + CODEC_VARINT_MAX_LEN)
+#define CODEC_TLV_DATA_MAX_LEN(len) (1 + CODEC_VARINT_MAX_LEN + (len))
+
+/* Status fields shared by CODEC_MSG_RESP and CODEC_MSG_STATUS */
+#define CODEC_STATUS_MAX_LEN (5 * CODEC_TLV_INT_MAX_LEN)
+
+
+static int codec_varint_len(u64 val)
+{
+	int len = 1;
+
+	while (val >= 0x80) {
+		val >>= 7;
+		len++;
+	}
+	return len;
+}
+
+
+void codec_put_varint(struct uagentbuf *buf, u64 val)
+{
+	while (val >= 0x80) {
+		uagentbuf_put_u8(buf, (val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	uagentbuf_put_u8(buf, val);
+}
+
+
+int codec_get_varint(const u8 **pos, const u8 *end, u64 *val)
+{
+	const u8 *p = *pos;
+	unsigned int shift = 0;
+	u64 v = 0;
+
+	while (p < end) {
+		if (shift >= 64)
+			return -1;
+		v |= (u64) (*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pos = p;
+			*val = v;
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+
+static void codec_put_tlv_varint(struct uagentbuf *buf, u8 tag, u64 val)
+{
+	uagentbuf_put_u8(buf, tag);
+	uagentbuf_put_u8(buf, codec_varint_len(val));
+	codec_put_varint(buf, val);
+}
+
+
+void codec_put_tlv_uint(struct uagentbuf *buf, u8 tag, u64 val)
+{
+	if (val)
+		codec_put_tlv_varint(buf, tag, val);
+}
+
+
+void codec_put_tlv_int(struct uagentbuf *buf, u8 tag, s64 val)
+{
+	codec_put_tlv_uint(buf, tag, codec_zigzag(val));
+}
+
+
+void codec_put_tlv_data(struct uagentbuf *buf, u8 tag, const void *data,
+			size_t len)
+{
+	if (len == 0)
+		return;
+	uagentbuf_put_u8(buf, tag);
+	codec_put_varint(buf, len);
+	uagentbuf_put_data(buf, data, len);
+}
+
+
+static struct uagentbuf * codec_alloc(u8 type, size_t len)
+{
+	struct uagentbuf *buf;
+
+	buf = uagentbuf_alloc_headroom(uagentBUF_HEADROOM, CODEC_HDR_LEN + len);
+	if (buf == NULL)
+		return NULL;
+	uagentbuf_put_u8(buf, CODEC_VERSION);
+	uagentbuf_put_u8(buf, type);
+	return buf;
+}
+
+
+int codec_parse(const u8 *data, size_t len, struct codec_msg *msg)
+{
+	if (len < CODEC_HDR_LEN || data[0] != CODEC_VERSION)
+		return -1;
+	msg->type = data[1];
+	msg->pos = data + CODEC_HDR_LEN;
+	msg->end = data + len;
+	return 0;
+}
+
+
+int codec_next_tlv(struct codec_msg *msg, u8 *tag, const u8 **val,
+		   size_t *val_len)
+{
+	const u8 *pos = msg->pos;
+	u64 len;
+
+	if (pos == msg->end)
+		return 0;
+	*tag = *pos++;
+	if (codec_get_varint(&pos, msg->end, &len) < 0 ||
+	    len > (size_t) (msg->end - pos))
+		return -1;
+	*val = pos;
+	*val_len = len;
+	msg->pos = pos + len;
+	return 1;
+}
+
+
+/* Decode an integer TLV value, which must be a single varint */
+static int codec_tlv_uint(const u8 *val, size_t len, u64 *v)
+{
+	const u8 *end = val + len;
+
+	if (codec_get_varint(&val, end, v) < 0 || val != end)
+		return -1;
+	return 0;
+}
+
+
+static void codec_put_status(struct uagentbuf *buf,
+			     const struct status_data *status)
+{
+	codec_put_tlv_uint(buf, CODEC_TAG_WIFI_MODULE,
+			   status->wifi_collect_module);
+	codec_put_tlv_uint(buf, CODEC_TAG_NET_TYPE, status->net_type);
+	codec_put_tlv_uint(buf, CODEC_TAG_IBEACON, status->ibeacon_status);
+	codec_put_tlv_int(buf, CODEC_TAG_CPU_USAGE, status->cpu_usage);
+	codec_put_tlv_uint(buf, CODEC_TAG_MEM_USAGE, status->mem_usage);
+}
+
+
+/*
+ * Store a status field in @status. Returns 1 if the tag is a status field, 0
+ * if not, -1 if the value is malformed.
+ */
+static int codec_get_status(u8 tag, const u8 *val, size_t len,
+			    struct status_data *status)
+{
+	u64 v;
+
+	switch (tag) {
+	case CODEC_TAG_WIFI_MODULE:
+	case CODEC_TAG_NET_TYPE:
+	case CODEC_TAG_IBEACON:
+	case CODEC_TAG_CPU_USAGE:
+	case CODEC_TAG_MEM_USAGE:
+		break;
+	default:
+		return 0;
+	}
+	if (codec_tlv_uint(val, len, &v) < 0)
+		return -1;
+	if (status == NULL)
+		return 1;
+	switch (tag) {
+	case CODEC_TAG_WIFI_MODULE:
+		status->wifi_collect_module = v;
+		break;
+	case CODEC_TAG_NET_TYPE:
+		status->net_type = v;
+		break;
+	case CODEC_TAG_IBEACON:
+		status->ibeacon_status = v;
+		break;
+	case CODEC_TAG_CPU_USAGE:
+		status->cpu_usage = codec_unzigzag(v);
+		break;
+	case CODEC_TAG_MEM_USAGE:
+		status->mem_usage = v;
+		break;
+	}
+	return 1;
+}
+
+
+struct uagentbuf * codec_encode_cmd(const struct server_msg *cmd)
+{
+	struct uagentbuf *buf;
+	size_t msg_len;
+
+	for (msg_len = 0; msg_len < sizeof(cmd->msg) && cmd->msg[msg_len];
+	     msg_len++)
+		;
+	buf = codec_alloc(CODEC_MSG_CMD, CODEC_TLV_INT_MAX_LEN +
+			  CODEC_TLV_DATA_MAX_LEN(msg_len));
+	if (buf == NULL)
+		return NULL;
+	/* Always present, UPDATE is zero */
+	codec_put_tlv_varint(buf, CODEC_TAG_CMD, cmd->srv_cmd);
+	codec_put_tlv_data(buf, CODEC_TAG_MSG, cmd->msg, msg_len);
+	return buf;
+}
+
+
+int codec_decode_cmd(const u8 *data, size_t len, struct server_msg *cmd)
+{
+	struct codec_msg msg;
+	const u8 *val;
+	size_t val_len;
+	int have_cmd = 0;
+	u8 tag;
+	u64 v;
+	int res;
+
+	if (codec_parse(data, len, &msg) < 0 || msg.type != CODEC_MSG_CMD)
+		return -1;
+	os_memset(cmd, 0, sizeof(*cmd));
+	while ((res = codec_next_tlv(&msg, &tag, &val, &val_len)) > 0) {
+		switch (tag) {
+		case CODEC_TAG_CMD:
+			if (codec_tlv_uint(val, val_len, &v) < 0)
+				return -1;
+			cmd->srv_cmd = v;
+			have_cmd = 1;
+			break;
+		case CODEC_TAG_MSG:
+			if (val_len >= sizeof(cmd->msg))
+				return -1;
+			os_memcpy(cmd->msg, val, val_len);
+			break;
+		}
+	}
+	if (res < 0 || !have_cmd)
+		return -1;
+	return 0;
+}
+
+
+struct uagentbuf * codec_encode_resp(const struct resp_data *resp,
+				     const struct status_data *status,
+				     const u8 *cpu_stats, size_t cpu_stats_len)
+{
+	struct uagentbuf *buf;
+
+	buf = codec_alloc(CODEC_MSG_RESP, 2 * CODEC_TLV_INT_MAX_LEN +
+			  CODEC_STATUS_MAX_LEN +
+			  CODEC_TLV_DATA_MAX_LEN(cpu_stats_len));
+	if (buf == NULL)
+		return NULL;
+	codec_put_tlv_varint(buf, CODEC_TAG_CMD, resp->srv_cmd);
+	codec_put_tlv_int(buf, CODEC_TAG_RESULT, resp->result);
+	if (status)
+		codec_put_status(buf, status);
+	if (cpu_stats)
+		codec_put_tlv_data(buf, CODEC_TAG_CPU_STATS, cpu_stats,
+				   cpu_stats_len);
+	return buf;
+}
+
+
+int codec_decode_resp(const u8 *data, size_t len, struct resp_data *resp,
+		      struct status_data *status, const u8 **cpu_stats,
+		      size_t *cpu_stats_len)
+{
+	struct codec_msg msg;
+	const u8 *val;
+	size_t val_len;
+	int have_cmd = 0;
+	u8 tag;
+	u64 v;
+	int res;
+
+	if (codec_parse(data, len, &msg) < 0 || msg.type != CODEC_MSG_RESP)
+		return -1;
+	os_memset(resp, 0, sizeof(*resp));
+	if (status)
+		os_memset(status, 0, sizeof(*status));
+	if (cpu_stats) {
+		*cpu_stats = NULL;
+		*cpu_stats_len = 0;
+	}
+	while ((res = codec_next_tlv(&msg, &tag, &val, &val_len)) > 0) {
+		switch (tag) {
+		case CODEC_TAG_CMD:
+			if (codec_tlv_uint(val, val_len, &v) < 0)
+				return -1;
+			resp->srv_cmd = v;
+			have_cmd = 1;
+			break;
+		case CODEC_TAG_RESULT:
+			if (codec_tlv_uint(val, val_len, &v) < 0)
+				return -1;
+			resp->result = codec_unzigzag(v);
+			break;
+		case CODEC_TAG_CPU_STATS:
+			if (cpu_stats) {
+				*cpu_stats = val;
+				*cpu_stats_len = val_len;
+			}
+			break;
+		default:
+			if (codec_get_status(tag, val, val_len, status) < 0)
+				return -1;
+			break;
+		}
+	}
+	if (res < 0 || !have_cmd)
+		return -1;
+	return 0;
+}
+
+
+struct uagentbuf * codec_encode_status(const struct status_data *status)
+{
+	struct uagentbuf *buf;
+
+	buf = codec_alloc(CODEC_MSG_STATUS, CODEC_STATUS_MAX_LEN);
+	if (buf == NULL)
+		return NULL;
+	codec_put_status(buf, status);
+	return buf;
+}
+
+
+int codec_decode_status(const u8 *data, size_t len,
+			struct status_data *status)
+{
+	struct codec_msg msg;
+	const u8 *val;
+	size_t val_len;
+	u8 tag;
+	int res;
+
+	if (codec_parse(data, len, &msg) < 0 || msg.type != CODEC_MSG_STATUS)
+		return -1;
+	os_memset(status, 0, sizeof(*status));
+	while ((res = codec_next_tlv(&msg, &tag, &val, &val_len)) > 0) {
+		if (codec_get_status(tag, val, val_len, status) < 0)
+			return -1;
+	}
+	return res < 0 ? -1 : 0;
+}
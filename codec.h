@@ -0,0 +1,223 @@
+/*
+ * Message codec
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines the encoding of the messages exchanged between the agent
+ * and the servers. The structures in server_cmd.h are never put on the wire
+ * as such, since their layout depends on the compiler and the ABI and a
+ * command with an empty msg would still cost its full 256 bytes.
+ *
+ * A message is a small header followed by TLVs:
+ *   u8 version (CODEC_VERSION)
+ *   u8 message type (CODEC_MSG_*)
+ *   TLVs: u8 tag (CODEC_TAG_*), varint length, value
+ *
+ * Integers are encoded as varints: 7 bits per byte, least significant group
+ * first, with the high bit set on all but the last byte. Signed values are
+ * zigzag mapped first so that small negative numbers stay short. Fixed width
+ * fields inside a value are big endian.
+ *
+ * Fields that are zero or empty are left out and decode as zero, except for
+ * the command, which is always present. Unknown tags are skipped so that new
+ * fields can be added without bumping the version.
+ *
+ * Encoded messages are allocated with %uagentBUF_HEADROOM octets of headroom,
+ * so that the framing headers can be prepended without copying the message.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "uagentbuf.h"
+
+struct server_msg;
+struct resp_data;
+struct status_data;
+
+#define CODEC_VERSION 1
+#define CODEC_HDR_LEN 2
+
+/* Longest varint, for a 64-bit value */
+#define CODEC_VARINT_MAX_LEN 10
+
+enum codec_msg_type {
+	CODEC_MSG_CMD = 1, /* server command, struct server_msg */
+	CODEC_MSG_RESP = 2, /* reply to a command, struct resp_data with the
+			     * struct status_data fields for STATUS */
+	CODEC_MSG_STATUS = 3, /* periodic status report, struct status_data */
+	CODEC_MSG_SIGNALS = 4 /* batch of struct wifi_signal_data records,
+			       * not TLV encoded, see upload.h */
+};
+
+enum codec_tag {
+	CODEC_TAG_CMD = 1, /* varint enum server_cmd */
+	CODEC_TAG_MSG = 2, /* bytes, command argument without terminating NUL */
+	CODEC_TAG_RESULT = 3, /* zigzag varint */
+	CODEC_TAG_WIFI_MODULE = 4, /* varint enum wifi_module_status */
+	CODEC_TAG_NET_TYPE = 5, /* varint enum network_type */
+	CODEC_TAG_IBEACON = 6, /* varint enum wifi_module_status */
+	CODEC_TAG_CPU_USAGE = 7, /* zigzag varint */
+	CODEC_TAG_MEM_USAGE = 8, /* varint */
+	CODEC_TAG_CPU_STATS = 9 /* bytes, see CPU_STATS_VERSION */
+};
+
+/**
+ * codec_zigzag - Map a signed value for varint encoding
+ * @val: Value
+ * Returns: @val mapped to 0, -1, 1, -2, 2, ... => 0, 1, 2, 3, 4, ...
+ */
+static inline u64 codec_zigzag(s64 val)
+{
+	return ((u64) val << 1) ^ (u64) (val >> 63);
+}
+
+/**
+ * codec_unzigzag - Reverse codec_zigzag()
+ * @val: Mapped value
+ * Returns: Signed value
+ */
+static inline s64 codec_unzigzag(u64 val)
+{
+	return (s64) (val >> 1) ^ -(s64) (val & 1);
+}
+
+/**
+ * codec_put_varint - Append a varint to a buffer
+ * @buf: Buffer with at least CODEC_VARINT_MAX_LEN bytes of tail room
+ * @val: Value to encode
+ */
+void codec_put_varint(struct uagentbuf *buf, u64 val);
+
+/**
+ * codec_get_varint - Decode a varint
+ * @pos: Position in the input, advanced past the varint on success
+ * @end: End of the input
+ * @val: Buffer for the value
+ * Returns: 0 on success, -1 if the input is truncated or the varint is too
+ * long
+ */
+int codec_get_varint(const u8 **pos, const u8 *end, u64 *val);
+
+/**
+ * codec_put_tlv_uint - Append an integer TLV unless the value is zero
+ * @buf: Buffer with enough tail room
+ * @tag: CODEC_TAG_* tag
+ * @val: Value to encode
+ */
+void codec_put_tlv_uint(struct uagentbuf *buf, u8 tag, u64 val);
+
+/**
+ * codec_put_tlv_int - Append a signed integer TLV unless the value is zero
+ * @buf: Buffer with enough tail room
+ * @tag: CODEC_TAG_* tag
+ * @val: Value to encode
+ */
+void codec_put_tlv_int(struct uagentbuf *buf, u8 tag, s64 val);
+
+/**
+ * codec_put_tlv_data - Append a byte string TLV unless it is empty
+ * @buf: Buffer with enough tail room
+ * @tag: CODEC_TAG_* tag
+ * @data: Value
+ * @len: Length of the value
+ */
+void codec_put_tlv_data(struct uagentbuf *buf, u8 tag, const void *data,
+			size_t len);
+
+/**
+ * struct codec_msg - Parsed message
+ * @type: CODEC_MSG_* message type
+ * @pos: Start of the TLVs not yet returned by codec_next_tlv()
+ * @end: End of the message
+ */
+struct codec_msg {
+	u8 type;
+	const u8 *pos;
+	const u8 *end;
+};
+
+/**
+ * codec_parse - Parse the header of a message
+ * @data: Message
+ * @len: Length of the message
+ * @msg: Buffer for the parsed message
+ * Returns: 0 on success, -1 if the message is too short or has an unknown
+ * version
+ */
+int codec_parse(const u8 *data, size_t len, struct codec_msg *msg);
+
+/**
+ * codec_next_tlv - Get the next TLV of a message
+ * @msg: Message from codec_parse()
+ * @tag: Buffer for the tag
+ * @val: Buffer for a pointer to the value
+ * @val_len: Buffer for the length of the value
+ * Returns: 1 if a TLV was returned, 0 at the end of the message, -1 if the
+ * message is malformed
+ */
+int codec_next_tlv(struct codec_msg *msg, u8 *tag, const u8 **val,
+		   size_t *val_len);
+
+/**
+ * codec_encode_cmd - Encode a server command
+ * @cmd: Command; msg is sent up to its terminating NUL and left out if empty
+ * Returns: Allocated buffer with the message or %NULL on failure
+ */
+struct uagentbuf * codec_encode_cmd(const struct server_msg *cmd);
+
+/**
+ * codec_decode_cmd - Decode a server command
+ * @data: Message
+ * @len: Length of the message
+ * @cmd: Buffer for the command, msg is always NUL terminated
+ * Returns: 0 on success, -1 if the message is not a valid command
+ */
+int codec_decode_cmd(const u8 *data, size_t len, struct server_msg *cmd);
+
+/**
+ * codec_encode_resp - Encode the reply to a command
+ * @resp: Command and result
+ * @status: Device status for a STATUS reply or %NULL
+ * @cpu_stats: CPU statistics for a STATUS reply or %NULL
+ * @cpu_stats_len: Length of the CPU statistics
+ * Returns: Allocated buffer with the message or %NULL on failure
+ */
+struct uagentbuf * codec_encode_resp(const struct resp_data *resp,
+				     const struct status_data *status,
+				     const u8 *cpu_stats, size_t cpu_stats_len);
+
+/**
+ * codec_decode_resp - Decode the reply to a command
+ * @data: Message
+ * @len: Length of the message
+ * @resp: Buffer for the command and result
+ * @status: Buffer for the device status or %NULL
+ * @cpu_stats: Buffer for a pointer to the CPU statistics within @data or %NULL
+ * @cpu_stats_len: Buffer for the length of the CPU statistics, 0 if none
+ * Returns: 0 on success, -1 if the message is not a valid reply
+ */
+int codec_decode_resp(const u8 *data, size_t len, struct resp_data *resp,
+		      struct status_data *status, const u8 **cpu_stats,
+		      size_t *cpu_stats_len);
+
+/**
+ * codec_encode_status - Encode a periodic status report
+ * @status: Device status
+ * Returns: Allocated buffer with the message or %NULL on failure
+ */
+struct uagentbuf * codec_encode_status(const struct status_data *status);
+
+/**
+ * codec_decode_status - Decode a periodic status report
+ * @data: Message
+ * @len: Length of the message
+ * @status: Buffer for the device status
+ * Returns: 0 on success, -1 if the message is not a valid report
+ */
+int codec_decode_status(const u8 *data, size_t len,
+			struct status_data *status);
+
+#endif /* CODEC_H */
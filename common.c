@@ -7,6 +7,12 @@
  */
 
 #include "includes.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif /* __ARM_NEON */
 
 #include "common.h"
 
@@ -184,25 +190,141 @@ void wpa_get_ntp_timestamp(u8 *buf)
 }
 
 
+#ifdef __SSE2__
+/* ASCII hex digits of the nibbles in @n, @alpha is the offset of 'a' or 'A' */
+static inline __m128i wpa_hex_sse2_digits(__m128i n, __m128i alpha)
+{
+	__m128i gt = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+			    _mm_and_si128(gt, alpha));
+}
+#endif /* __SSE2__ */
+
+#ifdef __ARM_NEON
+static inline uint8x16_t wpa_hex_neon_digits(uint8x16_t n, uint8x16_t alpha)
+{
+	uint8x16_t gt = vcgtq_u8(n, vdupq_n_u8(9));
+
+	return vaddq_u8(vaddq_u8(n, vdupq_n_u8('0')), vandq_u8(gt, alpha));
+}
+#endif /* __ARM_NEON */
+
+
+/**
+ * wpa_hex_encode - Encode binary data as hex digits
+ * @dst: Output buffer, 2 * len chars, or 3 * len chars with a separator
+ * @data: Data to be encoded
+ * @len: Length of data in bytes
+ * @sep: Character written in front of each octet or 0 for none
+ * @uppercase: Whether to use upper case hex digits
+ * Returns: Number of chars written, the output is not nul terminated
+ *
+ * Sixteen octets at a time are encoded with SIMD instructions where SSE2 or
+ * NEON is available, the rest through a digit table.
+ */
+size_t wpa_hex_encode(char *dst, const u8 *data, size_t len, char sep,
+		      int uppercase)
+{
+	const char *digits = uppercase ? "0123456789ABCDEF" :
+		"0123456789abcdef";
+	char *pos = dst;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i alpha = _mm_set1_epi8(uppercase ? 'A' - '0' - 10 :
+					    'a' - '0' - 10);
+	const __m128i sepv = _mm_set1_epi8(sep);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, hi, lo, pair[2], lo_pair[2], word[4];
+	u32 w[16];
+	unsigned int j;
+
+	for (; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) &data[i]);
+		hi = wpa_hex_sse2_digits(
+			_mm_and_si128(_mm_srli_epi16(v, 4), mask), alpha);
+		lo = wpa_hex_sse2_digits(_mm_and_si128(v, mask), alpha);
+		if (!sep) {
+			pair[0] = _mm_unpacklo_epi8(hi, lo);
+			pair[1] = _mm_unpackhi_epi8(hi, lo);
+			_mm_storeu_si128((__m128i *) pos, pair[0]);
+			_mm_storeu_si128((__m128i *) (pos + 16), pair[1]);
+			pos += 32;
+			continue;
+		}
+		/*
+		 * SSE2 has no byte shuffle to pack three-char groups, so each
+		 * octet becomes a 32-bit word of separator and digits, which is
+		 * stored without its last byte.
+		 */
+		pair[0] = _mm_unpacklo_epi8(sepv, hi);
+		pair[1] = _mm_unpackhi_epi8(sepv, hi);
+		lo_pair[0] = _mm_unpacklo_epi8(lo, zero);
+		lo_pair[1] = _mm_unpackhi_epi8(lo, zero);
+		word[0] = _mm_unpacklo_epi16(pair[0], lo_pair[0]);
+		word[1] = _mm_unpackhi_epi16(pair[0], lo_pair[0]);
+		word[2] = _mm_unpacklo_epi16(pair[1], lo_pair[1]);
+		word[3] = _mm_unpackhi_epi16(pair[1], lo_pair[1]);
+		for (j = 0; j < 4; j++)
+			_mm_storeu_si128((__m128i *) &w[4 * j], word[j]);
+		for (j = 0; j < 16; j++) {
+			os_memcpy(pos, &w[j], 3);
+			pos += 3;
+		}
+	}
+#endif /* __SSE2__ */
+#ifdef __ARM_NEON
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+	const uint8x16_t alpha = vdupq_n_u8(uppercase ? 'A' - '0' - 10 :
+					    'a' - '0' - 10);
+	uint8x16_t v;
+	uint8x16x2_t pair;
+	uint8x16x3_t triple;
+
+	for (; i + 16 <= len; i += 16) {
+		v = vld1q_u8(&data[i]);
+		if (!sep) {
+			pair.val[0] = wpa_hex_neon_digits(vshrq_n_u8(v, 4),
+							  alpha);
+			pair.val[1] = wpa_hex_neon_digits(vandq_u8(v, mask),
+							  alpha);
+			vst2q_u8((u8 *) pos, pair);
+			pos += 32;
+		} else {
+			triple.val[0] = vdupq_n_u8(sep);
+			triple.val[1] = wpa_hex_neon_digits(vshrq_n_u8(v, 4),
+							    alpha);
+			triple.val[2] = wpa_hex_neon_digits(vandq_u8(v, mask),
+							    alpha);
+			vst3q_u8((u8 *) pos, triple);
+			pos += 48;
+		}
+	}
+#endif /* __ARM_NEON */
+
+	for (; i < len; i++) {
+		if (sep)
+			*pos++ = sep;
+		*pos++ = digits[data[i] >> 4];
+		*pos++ = digits[data[i] & 0x0f];
+	}
+	return pos - dst;
+}
+
+
 static inline int _wpa_snprintf_hex(char *buf, size_t buf_size, const u8 *data,
 				    size_t len, int uppercase)
 {
-	size_t i;
-	char *pos = buf, *end = buf + buf_size;
-	int ret;
+	size_t res;
+
 	if (buf_size == 0)
 		return 0;
-	for (i = 0; i < len; i++) {
-		ret = os_snprintf(pos, end - pos, uppercase ? "%02X" : "%02x",
-				  data[i]);
-		if (ret < 0 || ret >= end - pos) {
-			end[-1] = '\0';
-			return pos - buf;
-		}
-		pos += ret;
-	}
-	end[-1] = '\0';
-	return pos - buf;
+	if (len > (buf_size - 1) / 2)
+		len = (buf_size - 1) / 2;
+	res = wpa_hex_encode(buf, data, len, 0, uppercase);
+	buf[res] = '\0';
+	return res;
 }
 
 /**
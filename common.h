@@ -325,6 +325,22 @@ static inline void WPA_PUT_LE64(u8 *a, u64 val)
 	a[0] = val & 0xff;
 }
 
+/* Names used by uagentbuf and the agent wire format code */
+#define uagent_GET_BE16 WPA_GET_BE16
+#define uagent_PUT_BE16 WPA_PUT_BE16
+#define uagent_GET_LE16 WPA_GET_LE16
+#define uagent_PUT_LE16 WPA_PUT_LE16
+#define uagent_GET_BE24 WPA_GET_BE24
+#define uagent_PUT_BE24 WPA_PUT_BE24
+#define uagent_GET_BE32 WPA_GET_BE32
+#define uagent_PUT_BE32 WPA_PUT_BE32
+#define uagent_GET_LE32 WPA_GET_LE32
+#define uagent_PUT_LE32 WPA_PUT_LE32
+#define uagent_GET_BE64 WPA_GET_BE64
+#define uagent_PUT_BE64 WPA_PUT_BE64
+#define uagent_GET_LE64 WPA_GET_LE64
+#define uagent_PUT_LE64 WPA_PUT_LE64
+
 
 #ifndef ETH_ALEN
 #define ETH_ALEN 6
@@ -442,6 +458,10 @@ void perror(const char *s);
 #define BIT(x) (1 << (x))
 #endif
 
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
 /*
  * Definitions for sparse validation
  * (http://kernel.org/pub/linux/kernel/people/josh/sparse/)
@@ -476,6 +496,8 @@ int hex2byte(const char *hex);
 int hexstr2bin(const char *hex, u8 *buf, size_t len);
 void inc_byte_array(u8 *counter, size_t len);
 void wpa_get_ntp_timestamp(u8 *buf);
+size_t wpa_hex_encode(char *dst, const u8 *data, size_t len, char sep,
+		      int uppercase);
 int wpa_snprintf_hex(char *buf, size_t buf_size, const u8 *data, size_t len);
 int wpa_snprintf_hex_uppercase(char *buf, size_t buf_size, const u8 *data,
 			       size_t len);
@@ -0,0 +1,273 @@
+/*
+ * Stream framing
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "framing.h"
+#include "sendq.h"
+
+
+struct frame_conn * frame_conn_init(int sock, frame_handler handler,
+				    void *ctx)
+{
+	struct frame_conn *conn;
+
+	conn = os_zalloc(sizeof(*conn));
+	if (conn == NULL)
+		return NULL;
+	conn->rx = uagentbuf_alloc_nozero(FRAME_RX_CHUNK);
+	if (conn->rx == NULL) {
+		os_free(conn);
+		return NULL;
+	}
+	conn->sock = sock;
+	conn->handler = handler;
+	conn->ctx = ctx;
+	return conn;
+}
+
+
+void frame_conn_deinit(struct frame_conn *conn)
+{
+	if (conn == NULL)
+		return;
+	uagentbuf_free(conn->rx);
+	os_free(conn);
+}
+
+
+int frame_conn_receive(struct frame_conn *conn)
+{
+	const u8 *pos;
+	size_t left, flen;
+	ssize_t res;
+
+	if (uagentbuf_tailroom(conn->rx) < FRAME_RX_CHUNK &&
+	    uagentbuf_reserve(&conn->rx, FRAME_RX_CHUNK) < 0)
+		return -1;
+
+	res = read(conn->sock, uagentbuf_mhead_u8(conn->rx) +
+		   uagentbuf_len(conn->rx), uagentbuf_tailroom(conn->rx));
+	if (res < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		uagent_printf(MSG_ERROR, "framing: read(%d): %s", conn->sock,
+			      strerror(errno));
+		return -1;
+	}
+	if (res == 0)
+		return -1;
+	uagentbuf_put(conn->rx, res);
+
+	/* Deliver every complete frame, keep a trailing partial one */
+	pos = uagentbuf_head_u8(conn->rx);
+	left = uagentbuf_len(conn->rx);
+	while (left >= FRAME_HDR_LEN) {
+		flen = uagent_GET_BE16(pos);
+		if (left < FRAME_HDR_LEN + flen)
+			break;
+		conn->handler(conn, pos + FRAME_HDR_LEN, flen, conn->ctx);
+		pos += FRAME_HDR_LEN + flen;
+		left -= FRAME_HDR_LEN + flen;
+	}
+	uagentbuf_consume(conn->rx, uagentbuf_len(conn->rx) - left);
+
+	return 0;
+}
+
+
+int frame_sendv(int sock, const struct iovec *iov, int iovcnt)
+{
+	struct iovec vec[FRAME_MAX_IOV + 1], *pos = vec;
+	u8 hdr[FRAME_HDR_LEN];
+	size_t len = 0;
+	ssize_t res;
+	int i, left;
+
+	if (iovcnt > FRAME_MAX_IOV)
+		return -1;
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+		vec[i + 1] = iov[i];
+	}
+	if (len > FRAME_MAX_LEN)
+		return -1;
+	uagent_PUT_BE16(hdr, len);
+	vec[0].iov_base = hdr;
+	vec[0].iov_len = sizeof(hdr);
+	left = iovcnt + 1;
+
+	/* The sockets are blocking, so a short write only follows a signal */
+	while (left > 0) {
+		res = writev(sock, pos, left);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			uagent_printf(MSG_ERROR, "framing: writev(%d): %s",
+				      sock, strerror(errno));
+			return -1;
+		}
+		while (left > 0 && (size_t) res >= pos->iov_len) {
+			res -= pos->iov_len;
+			pos++;
+			left--;
+		}
+		if (left > 0) {
+			pos->iov_base = (u8 *) pos->iov_base + res;
+			pos->iov_len -= res;
+		}
+	}
+	return 0;
+}
+
+
+int frame_send(int sock, const void *data, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) data;
+	iov.iov_len = len;
+	return frame_sendv(sock, &iov, 1);
+}
+
+
+int frame_send_ctrl(int sock, u8 flags, u32 id, const void *data, size_t len)
+{
+	u8 hdr[FRAME_CTRL_HDR_LEN];
+	struct iovec iov[2];
+
+	hdr[0] = FRAME_CTRL_VERSION;
+	hdr[1] = flags;
+	uagent_PUT_BE32(hdr + 2, id);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = len;
+	return frame_sendv(sock, iov, 2);
+}
+
+
+int frame_queuev(struct sendq *q, const struct iovec *iov, int iovcnt)
+{
+	struct uagentbuf *buf;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len > FRAME_MAX_LEN)
+		return -1;
+	buf = uagentbuf_alloc_nozero(FRAME_HDR_LEN + len);
+	if (buf == NULL)
+		return -1;
+	uagentbuf_put_be16(buf, len);
+	for (i = 0; i < iovcnt; i++)
+		uagentbuf_put_data(buf, iov[i].iov_base, iov[i].iov_len);
+	return sendq_push(q, buf);
+}
+
+
+int frame_queue(struct sendq *q, const void *data, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) data;
+	iov.iov_len = len;
+	return frame_queuev(q, &iov, 1);
+}
+
+
+int frame_queue_ctrl(struct sendq *q, u8 flags, u32 id, const void *data,
+		     size_t len)
+{
+	u8 hdr[FRAME_CTRL_HDR_LEN];
+	struct iovec iov[2];
+
+	hdr[0] = FRAME_CTRL_VERSION;
+	hdr[1] = flags;
+	uagent_PUT_BE32(hdr + 2, id);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = len;
+	return frame_queuev(q, iov, 2);
+}
+
+
+int frame_queue_chain(struct sendq *q, struct uagentbuf_chain *chain)
+{
+	size_t len = uagentbuf_chain_len(chain);
+	u8 *hdr;
+
+	if (len > FRAME_MAX_LEN) {
+		uagentbuf_chain_clear(chain);
+		return -1;
+	}
+	hdr = uagentbuf_chain_push(chain, FRAME_HDR_LEN);
+	if (hdr == NULL) {
+		uagentbuf_chain_clear(chain);
+		return -1;
+	}
+	uagent_PUT_BE16(hdr, len);
+	return sendq_push_chain(q, chain);
+}
+
+
+int frame_queue_ctrl_chain(struct sendq *q, u8 flags, u32 id,
+			   struct uagentbuf_chain *chain)
+{
+	u8 *hdr;
+
+	hdr = uagentbuf_chain_push(chain, FRAME_CTRL_HDR_LEN);
+	if (hdr == NULL) {
+		uagentbuf_chain_clear(chain);
+		return -1;
+	}
+	hdr[0] = FRAME_CTRL_VERSION;
+	hdr[1] = flags;
+	uagent_PUT_BE32(hdr + 2, id);
+	return frame_queue_chain(q, chain);
+}
+
+
+int frame_queue_buf(struct sendq *q, struct uagentbuf *buf)
+{
+	struct uagentbuf_chain chain;
+
+	uagentbuf_chain_init(&chain);
+	if (uagentbuf_chain_append(&chain, buf) < 0)
+		return -1;
+	return frame_queue_chain(q, &chain);
+}
+
+
+int frame_queue_ctrl_buf(struct sendq *q, u8 flags, u32 id,
+			 struct uagentbuf *buf)
+{
+	struct uagentbuf_chain chain;
+
+	uagentbuf_chain_init(&chain);
+	if (uagentbuf_chain_append(&chain, buf) < 0)
+		return -1;
+	return frame_queue_ctrl_chain(q, flags, id, &chain);
+}
+
+
+int frame_parse_ctrl(const u8 **data, size_t *len, u8 *flags, u32 *id)
+{
+	const u8 *pos = *data;
+
+	if (*len < FRAME_CTRL_HDR_LEN || pos[0] != FRAME_CTRL_VERSION)
+		return -1;
+	*flags = pos[1];
+	*id = uagent_GET_BE32(pos + 2);
+	*data += FRAME_CTRL_HDR_LEN;
+	*len -= FRAME_CTRL_HDR_LEN;
+	return 0;
+}
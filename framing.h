@@ -0,0 +1,235 @@
+/*
+ * Stream framing
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines the framing used on the TCP connections between the agent
+ * and the servers. Every message is preceded by its length so that the
+ * receiver can split the byte stream back into messages regardless of how
+ * TCP segments or coalesces them.
+ *
+ * Frames on the control channel start with a control header that carries a
+ * request ID, so that several commands can be in flight on one connection and
+ * the replies can come back in any order.
+ */
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include "uagentbuf.h"
+
+struct sendq;
+
+/*
+ * Frame header: u16 payload length in network byte order, followed by the
+ * payload.
+ */
+#define FRAME_HDR_LEN 2
+#define FRAME_MAX_LEN 0xffff
+
+/* Minimum tail room made available for each read() */
+#define FRAME_RX_CHUNK 1024
+
+/*
+ * Control header at the start of a control channel frame payload:
+ *   u8 version (FRAME_CTRL_VERSION)
+ *   u8 flags (FRAME_CTRL_FLAG_*)
+ *   u32 request ID in network byte order; a response carries the ID of the
+ *	request, notifications use 0
+ */
+#define FRAME_CTRL_HDR_LEN 6
+#define FRAME_CTRL_VERSION 1
+
+/*
+ * Headroom for prepending both headers in place; %uagentBUF_HEADROOM, which
+ * the message encoders reserve, is enough for it
+ */
+#define FRAME_HEADROOM (FRAME_HDR_LEN + FRAME_CTRL_HDR_LEN)
+
+/* The frame is a response to the request with the same ID */
+#define FRAME_CTRL_FLAG_RESPONSE BIT(0)
+/* The frame is a notification that is not answered */
+#define FRAME_CTRL_FLAG_NOTIFY BIT(1)
+
+struct frame_conn;
+
+/**
+ * frame_handler - Callback for a received frame
+ * @conn: Connection the frame was received on
+ * @data: Frame payload, valid only during the call
+ * @len: Length of the payload
+ * @ctx: Callback context data from frame_conn_init()
+ */
+typedef void (*frame_handler)(struct frame_conn *conn, const u8 *data,
+			      size_t len, void *ctx);
+
+/**
+ * struct frame_conn - Receive state of a framed connection
+ * @sock: Socket of the connection
+ * @rx: Reassembly buffer holding the bytes of incomplete frames
+ * @handler: Callback for each complete frame
+ * @ctx: Callback context data
+ */
+struct frame_conn {
+	int sock;
+	struct uagentbuf *rx;
+	frame_handler handler;
+	void *ctx;
+};
+
+/**
+ * frame_conn_init - Allocate receive state for a framed connection
+ * @sock: Connected socket
+ * @handler: Callback for each complete frame
+ * @ctx: Callback context data
+ * Returns: Pointer to the connection or %NULL on failure
+ *
+ * The socket is not closed by frame_conn_deinit().
+ */
+struct frame_conn * frame_conn_init(int sock, frame_handler handler,
+				    void *ctx);
+
+/**
+ * frame_conn_deinit - Free receive state of a framed connection
+ * @conn: Connection from frame_conn_init() or %NULL
+ */
+void frame_conn_deinit(struct frame_conn *conn);
+
+/**
+ * frame_conn_receive - Read from a framed connection
+ * @conn: Connection from frame_conn_init()
+ * Returns: 0 on success, -1 if the peer closed the connection or on error
+ *
+ * This is meant to be called from the read handler of the socket. It reads
+ * what is available and calls the frame handler for every complete frame in
+ * the reassembly buffer. A partial frame is kept until more bytes arrive.
+ */
+int frame_conn_receive(struct frame_conn *conn);
+
+/**
+ * frame_send - Send a frame
+ * @sock: Connected socket in blocking mode
+ * @data: Frame payload
+ * @len: Length of the payload, at most %FRAME_MAX_LEN
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_send(int sock, const void *data, size_t len);
+
+/**
+ * frame_sendv - Send a frame with the payload in several pieces
+ * @sock: Connected socket in blocking mode
+ * @iov: Payload pieces
+ * @iovcnt: Number of pieces, at most %FRAME_MAX_IOV
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_sendv(int sock, const struct iovec *iov, int iovcnt);
+
+#define FRAME_MAX_IOV 8
+
+/**
+ * frame_send_ctrl - Send a control channel frame
+ * @sock: Connected socket in blocking mode
+ * @flags: FRAME_CTRL_FLAG_* flags
+ * @id: Request ID
+ * @data: Message following the control header
+ * @len: Length of the message
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_send_ctrl(int sock, u8 flags, u32 id, const void *data, size_t len);
+
+/**
+ * frame_queuev - Queue a frame with the payload in several pieces
+ * @q: Output queue of the connection, see sendq.h
+ * @iov: Payload pieces, copied into the queue
+ * @iovcnt: Number of pieces
+ * Returns: 0 on success, -1 on failure
+ *
+ * The frame_queue*() functions are the non-blocking counterparts of the
+ * frame_send*() functions: the frame is handed to the output queue, which
+ * writes it out as the socket allows.
+ */
+int frame_queuev(struct sendq *q, const struct iovec *iov, int iovcnt);
+
+/**
+ * frame_queue - Queue a frame
+ * @q: Output queue of the connection
+ * @data: Frame payload
+ * @len: Length of the payload, at most %FRAME_MAX_LEN
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_queue(struct sendq *q, const void *data, size_t len);
+
+/**
+ * frame_queue_ctrl - Queue a control channel frame
+ * @q: Output queue of the connection
+ * @flags: FRAME_CTRL_FLAG_* flags
+ * @id: Request ID
+ * @data: Message following the control header
+ * @len: Length of the message
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_queue_ctrl(struct sendq *q, u8 flags, u32 id, const void *data,
+		     size_t len);
+
+/**
+ * frame_queue_chain - Queue a frame without copying its payload
+ * @q: Output queue of the connection
+ * @chain: Frame payload, at most %FRAME_MAX_LEN octets; the segments are
+ *	owned by the queue from now on even on failure
+ * Returns: 0 on success, -1 on failure
+ *
+ * The frame header is prepended in the headroom of the first segment if it
+ * has %FRAME_HDR_LEN octets to spare, see uagentbuf_alloc_headroom(), and
+ * the segments are written out with writev() as they are.
+ */
+int frame_queue_chain(struct sendq *q, struct uagentbuf_chain *chain);
+
+/**
+ * frame_queue_ctrl_chain - Queue a control channel frame without copying
+ * @q: Output queue of the connection
+ * @flags: FRAME_CTRL_FLAG_* flags
+ * @id: Request ID
+ * @chain: Message following the control header, owned by the queue from now
+ *	on even on failure
+ * Returns: 0 on success, -1 on failure
+ *
+ * Both headers fit in the headroom of a first segment that has
+ * %FRAME_HEADROOM octets of it.
+ */
+int frame_queue_ctrl_chain(struct sendq *q, u8 flags, u32 id,
+			   struct uagentbuf_chain *chain);
+
+/**
+ * frame_queue_buf - Queue a frame from a single buffer without copying
+ * @q: Output queue of the connection
+ * @buf: Frame payload, owned by the queue from now on even on failure
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_queue_buf(struct sendq *q, struct uagentbuf *buf);
+
+/**
+ * frame_queue_ctrl_buf - Queue a control channel frame from a single buffer
+ * @q: Output queue of the connection
+ * @flags: FRAME_CTRL_FLAG_* flags
+ * @id: Request ID
+ * @buf: Message following the control header, owned by the queue from now on
+ *	even on failure
+ * Returns: 0 on success, -1 on failure
+ */
+int frame_queue_ctrl_buf(struct sendq *q, u8 flags, u32 id,
+			 struct uagentbuf *buf);
+
+/**
+ * frame_parse_ctrl - Parse the control header of a frame
+ * @data: Frame payload, advanced past the control header on success
+ * @len: Length of the payload, reduced by the control header on success
+ * @flags: Buffer for the flags
+ * @id: Buffer for the request ID
+ * Returns: 0 on success, -1 if the frame is too short or has an unknown
+ * version
+ */
+int frame_parse_ctrl(const u8 **data, size_t *len, u8 *flags, u32 *id);
+
+#endif /* FRAMING_H */
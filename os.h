@@ -46,6 +46,38 @@ int os_get_time(struct os_time *t);
 	} \
 } while (0)
 
+struct os_reltime {
+	os_time_t sec;
+	os_time_t usec;
+};
+
+/**
+ * os_get_reltime - Get relative time (sec, usec)
+ * @t: Pointer to buffer for the time
+ * Returns: 0 on success, -1 on failure
+ *
+ * The time is taken from a monotonic clock that is not affected by changes to
+ * the system wall clock (e.g., NTP steps or manual adjustment). It has no
+ * relation to calendar time and must only be used to measure intervals, e.g.,
+ * for timeouts. Building with CONFIG_OS_RELTIME_COARSE selects a cheaper clock
+ * source with tick (typically 1-10 ms) resolution where available.
+ */
+int os_get_reltime(struct os_reltime *t);
+
+/* Helper macros for handling struct os_reltime */
+
+#define os_reltime_before(a, b) os_time_before((a), (b))
+
+#define os_reltime_sub(a, b, res) os_time_sub((a), (b), (res))
+
+#define os_reltime_add_usec(t, u) do { \
+	(t)->usec += (u); \
+	while ((t)->usec >= 1000000) { \
+		(t)->sec++; \
+		(t)->usec -= 1000000; \
+	} \
+} while (0)
+
 /**
  * os_mktime - Convert broken-down time into seconds since 1970-01-01
  * @year: Four digit year
@@ -53,6 +53,48 @@ int os_get_time(struct os_time *t)
 }
 
 
+int os_get_reltime(struct os_reltime *t)
+{
+#if defined(CONFIG_OS_RELTIME_COARSE) && defined(CLOCK_MONOTONIC_COARSE)
+	static clockid_t clock_id = CLOCK_MONOTONIC_COARSE;
+#elif defined(CLOCK_MONOTONIC)
+	static clockid_t clock_id = CLOCK_MONOTONIC;
+#else
+	static clockid_t clock_id = CLOCK_REALTIME;
+#endif
+	struct timespec ts;
+	int res;
+
+	while (1) {
+		res = clock_gettime(clock_id, &ts);
+		if (res == 0) {
+			t->sec = ts.tv_sec;
+			t->usec = ts.tv_nsec / 1000;
+			return 0;
+		}
+		/* Fall back to the next best clock the kernel supports */
+		switch (clock_id) {
+#ifdef CLOCK_MONOTONIC_COARSE
+		case CLOCK_MONOTONIC_COARSE:
+#ifdef CLOCK_MONOTONIC
+			clock_id = CLOCK_MONOTONIC;
+#else
+			clock_id = CLOCK_REALTIME;
+#endif
+			continue;
+#endif /* CLOCK_MONOTONIC_COARSE */
+#ifdef CLOCK_MONOTONIC
+		case CLOCK_MONOTONIC:
+			clock_id = CLOCK_REALTIME;
+			continue;
+#endif /* CLOCK_MONOTONIC */
+		default:
+			return -1;
+		}
+	}
+}
+
+
 int os_mktime(int year, int month, int day, int hour, int min, int sec,
 	      os_time_t *t)
 {
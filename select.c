@@ -13,121 +13,416 @@
 #include "list.h"
 #include "select.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef CONFIG_SELECT_EPOLL
+#include <sys/epoll.h>
+#else /* CONFIG_SELECT_EPOLL */
+#include <sys/select.h>
+#endif /* CONFIG_SELECT_EPOLL */
+
+
+struct select_sock {
+	int sock;
+	void *select_data;
+	void *user_data;
+	select_sock_handler handler;
+	unsigned int gen; /* registration generation, see select_sock_is_new() */
+};
+
+struct select_signal {
+	int sig;
+	void *user_data;
+	select_signal_handler handler;
+	int signaled;
+};
+
+struct select_sock_table {
+	int count;
+	struct select_sock *table; /* indexed by fd, handler NULL if unused */
+	int size; /* number of entries allocated in table */
+	int changed;
+	select_event_type type;
+#ifndef CONFIG_SELECT_EPOLL
+	fd_set fds; /* registered sockets, copied for each select() call */
+#endif /* CONFIG_SELECT_EPOLL */
+};
+
+struct select_loop {
+	void *user_data;
+	int max_sock;
+
+	int count; /* sum of all table counts */
+	struct select_sock_table readers;
+	struct select_sock_table writers;
+	struct select_sock_table exceptions;
+
+	struct select_timeout **timeout_heap;
+	unsigned int timeout_count;
+	unsigned int timeout_alloc;
+	unsigned int timeout_seq;
+	unsigned int timeout_batch_max;
+	struct select_timeout_stats timeout_stats;
+
+	struct os_reltime now; /* cached time of the current loop iteration */
+	int now_stale; /* handlers ran since now was taken */
+	int running;
+
+	int signal_count;
+	struct select_signal *signals;
+	int signaled;
+	int pending_terminate;
+
+	int terminate;
+	int reader_table_changed;
+
+	unsigned int sock_gen;
+
+	int persistent; /* keep running with no handlers, for worker loops */
+	int wakeup_fd[2]; /* self-pipe written by select_loop_post() */
+	int wakeup_pending; /* a byte is in the pipe, protected by post_lock */
+	int terminate_request; /* from another thread, protected by post_lock */
+	pthread_mutex_t post_lock;
+	struct dl_list posts; /* struct select_post, protected by post_lock */
+
+#ifdef CONFIG_SELECT_EPOLL
+	int epollfd;
+	int epoll_max_event_num;
+	struct epoll_event *epoll_events;
+	unsigned int *epoll_mask; /* events currently registered with epoll per fd */
+	int epoll_mask_size;
+#endif /* CONFIG_SELECT_EPOLL */
+};
+
+/* Callback queued with select_loop_post() */
+struct select_post {
+	struct dl_list list;
+	select_timeout_handler handler;
+	void *select_data;
+	void *user_data;
+};
 
-static struct select_data uagent_select;
+
+/*
+ * The select_* functions without a loop argument operate on the current loop
+ * of the calling thread: the one select_loop_run() is running, otherwise the
+ * one created by select_init(). Several threads can thus run independent
+ * loops, e.g., one per CPU core, and handlers keep using the short API.
+ */
+static __thread struct select_loop *uagent_select;
 
 
 #define select_trace_sock_add_ref(table) do { } while (0)
 #define select_trace_sock_remove_ref(table) do { } while (0)
 
 
-int select_init(void)
+static struct select_sock_table *
+select_get_sock_table(struct select_loop *sel, select_event_type type)
 {
-	os_memset(&uagent_select, 0, sizeof(uagent_select));
-	dl_list_init(&uagent_select.timeout);
-	uagent_printf(MSG_INFO,"select init is okay.\n");
-	return 0;
+	switch (type) {
+	case EVENT_TYPE_READ:
+		return &sel->readers;
+	case EVENT_TYPE_WRITE:
+		return &sel->writers;
+	case EVENT_TYPE_EXCEPTION:
+		return &sel->exceptions;
+	}
+
+	return NULL;
 }
 
-static int select_sock_table_add_sock(struct select_sock_table *table,
-                                     int sock, select_sock_handler handler,
-                                     void *select_data, void *user_data)
+
+/*
+ * Socket tables are indexed by file descriptor, so registering and
+ * unregistering a socket is O(1). An entry is unused when its handler is
+ * %NULL. The tables grow geometrically to cover the highest descriptor.
+ */
+static struct select_sock * select_sock_table_get(struct select_sock_table *table,
+						 int sock)
+{
+	if (sock < 0 || sock >= table->size || table->table[sock].handler == NULL)
+		return NULL;
+	return &table->table[sock];
+}
+
+
+static int select_sock_table_grow(struct select_sock_table *table, int sock)
 {
 	struct select_sock *tmp;
-	int new_max_sock;
+	int next;
+
+	if (sock < table->size)
+		return 0;
+
+	next = table->size ? table->size * 2 : 16;
+	if (next <= sock)
+		next = sock + 1;
+	tmp = os_realloc_array(table->table, next, sizeof(struct select_sock));
+	if (tmp == NULL)
+		return -1;
+	os_memset(&tmp[table->size], 0,
+		  (next - table->size) * sizeof(struct select_sock));
+	table->table = tmp;
+	table->size = next;
+	return 0;
+}
+
+
+/*
+ * Entries registered while the tables are being dispatched must not see
+ * readiness that was reported for an earlier socket with the same descriptor
+ * number. Every registration is stamped with a generation number and dispatch
+ * skips entries newer than the generation at the start of the dispatch.
+ */
+static int select_sock_is_new(const struct select_sock *s, unsigned int gen)
+{
+	return (int) (s->gen - gen) > 0;
+}
+
+
+#ifdef CONFIG_SELECT_EPOLL
+static u32 select_epoll_events(select_event_type type)
+{
+	switch (type) {
+	case EVENT_TYPE_READ:
+		return EPOLLIN;
+	case EVENT_TYPE_WRITE:
+		return EPOLLOUT;
+	case EVENT_TYPE_EXCEPTION:
+		return EPOLLPRI;
+	}
+	return 0;
+}
+
+
+/*
+ * Recalculate the kernel interest set of one descriptor from the handlers
+ * that are currently registered for it in the three socket tables. A socket
+ * can be registered for read and write at the same time, so the combined
+ * mask is pushed with EPOLL_CTL_MOD once the descriptor is known to epoll.
+ */
+static int select_epoll_update(struct select_loop *sel, int sock)
+{
+	struct epoll_event ev;
+	u32 events = 0;
+	int op;
+
+	if (sock >= sel->epoll_mask_size) {
+		u32 *mask;
+		int next = sel->epoll_mask_size ?
+			sel->epoll_mask_size * 2 : 16;
+
+		if (next <= sock)
+			next = sock + 1;
+		mask = os_realloc_array(sel->epoll_mask, next,
+					sizeof(u32));
+		if (mask == NULL)
+			return -1;
+		os_memset(&mask[sel->epoll_mask_size], 0,
+			  (next - sel->epoll_mask_size) * sizeof(u32));
+		sel->epoll_mask = mask;
+		sel->epoll_mask_size = next;
+	}
+
+	if (select_sock_table_get(&sel->readers, sock))
+		events |= select_epoll_events(EVENT_TYPE_READ);
+	if (select_sock_table_get(&sel->writers, sock))
+		events |= select_epoll_events(EVENT_TYPE_WRITE);
+	if (select_sock_table_get(&sel->exceptions, sock))
+		events |= select_epoll_events(EVENT_TYPE_EXCEPTION);
 
-	if (sock > uagent_select.max_sock)
-		new_max_sock = sock;
+	if (events == sel->epoll_mask[sock])
+		return 0;
+
+	os_memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = sock;
+	if (sel->epoll_mask[sock] == 0)
+		op = EPOLL_CTL_ADD;
+	else if (events == 0)
+		op = EPOLL_CTL_DEL;
 	else
-		new_max_sock = uagent_select.max_sock;
+		op = EPOLL_CTL_MOD;
+
+	if (epoll_ctl(sel->epollfd, op, sock, &ev) < 0) {
+		/* The descriptor may already be closed when unregistering */
+		if (op != EPOLL_CTL_DEL) {
+			uagent_printf(MSG_ERROR, "select: epoll_ctl(%d) for "
+				      "sock %d failed: %s", op, sock,
+				      strerror(errno));
+			return -1;
+		}
+	}
+	sel->epoll_mask[sock] = events;
+	return 0;
+}
+#endif /* CONFIG_SELECT_EPOLL */
 
-	if (table == NULL)
+
+static int select_sock_table_add_sock(struct select_loop *sel,
+				      struct select_sock_table *table,
+				      int sock, select_sock_handler handler,
+				      void *select_data, void *user_data)
+{
+	struct select_sock *tmp;
+	int added;
+
+	if (table == NULL || sock < 0)
+		return -1;
+#ifndef CONFIG_SELECT_EPOLL
+	if (sock >= FD_SETSIZE) {
+		uagent_printf(MSG_ERROR, "select: sock %d exceeds FD_SETSIZE "
+			      "(%d)", sock, FD_SETSIZE);
 		return -1;
+	}
+#endif /* CONFIG_SELECT_EPOLL */
+
+#ifdef CONFIG_SELECT_EPOLL
+	if (sel->count + 1 > sel->epoll_max_event_num) {
+		struct epoll_event *events;
+		int next = sel->epoll_max_event_num ?
+			sel->epoll_max_event_num * 2 : 8;
+
+		events = os_realloc_array(sel->epoll_events, next,
+					  sizeof(struct epoll_event));
+		if (events == NULL)
+			return -1;
+		sel->epoll_events = events;
+		sel->epoll_max_event_num = next;
+	}
+#endif /* CONFIG_SELECT_EPOLL */
 
-	select_trace_sock_remove_ref(table);
-	tmp = os_realloc_array(table->table, table->count + 1,
-			       sizeof(struct select_sock));
-	if (tmp == NULL)
+	if (select_sock_table_grow(table, sock) < 0)
 		return -1;
 
-	tmp[table->count].sock = sock;
-	tmp[table->count].select_data = select_data;
-	tmp[table->count].user_data = user_data;
-	tmp[table->count].handler = handler;
-	/*wpa_trace_record(&tmp[table->count]);*/
-	table->count++;
-	table->table = tmp;
-	uagent_select.max_sock = new_max_sock;
-	uagent_select.count++;
+	select_trace_sock_remove_ref(table);
+	tmp = &table->table[sock];
+	added = tmp->handler == NULL;
+	tmp->sock = sock;
+	tmp->select_data = select_data;
+	tmp->user_data = user_data;
+	tmp->handler = handler;
+	tmp->gen = ++sel->sock_gen;
+	/*wpa_trace_record(tmp);*/
+	if (added) {
+		table->count++;
+		sel->count++;
+	}
 	table->changed = 1;
 	select_trace_sock_add_ref(table);
 
+#ifdef CONFIG_SELECT_EPOLL
+	if (select_epoll_update(sel, sock) < 0) {
+		os_memset(tmp, 0, sizeof(*tmp));
+		if (added) {
+			table->count--;
+			sel->count--;
+		}
+		return -1;
+	}
+#else /* CONFIG_SELECT_EPOLL */
+	FD_SET(sock, &table->fds);
+#endif /* CONFIG_SELECT_EPOLL */
+	if (sock > sel->max_sock)
+		sel->max_sock = sock;
+
 	return 0;
 }
 
 
-static void select_sock_table_remove_sock(struct select_sock_table *table,
-                                         int sock)
+static void select_sock_table_remove_sock(struct select_loop *sel,
+					  struct select_sock_table *table,
+					  int sock)
 {
-	int i;
+	struct select_sock *tmp;
 
-	if (table == NULL || table->table == NULL || table->count == 0)
+	if (table == NULL)
 		return;
-
-	for (i = 0; i < table->count; i++) {
-		if (table->table[i].sock == sock)
-			break;
-	}
-	if (i == table->count)
+	tmp = select_sock_table_get(table, sock);
+	if (tmp == NULL)
 		return;
+
 	select_trace_sock_remove_ref(table);
-	if (i != table->count - 1) {
-		os_memmove(&table->table[i], &table->table[i + 1],
-			   (table->count - i - 1) *
-			   sizeof(struct select_sock));
-	}
+	os_memset(tmp, 0, sizeof(*tmp));
 	table->count--;
-	uagent_select.count--;
+	sel->count--;
 	table->changed = 1;
 	select_trace_sock_add_ref(table);
+#ifdef CONFIG_SELECT_EPOLL
+	select_epoll_update(sel, sock);
+#else /* CONFIG_SELECT_EPOLL */
+	FD_CLR(sock, &table->fds);
+#endif /* CONFIG_SELECT_EPOLL */
+
+	while (sel->max_sock >= 0 &&
+	       !select_sock_table_get(&sel->readers,
+				      sel->max_sock) &&
+	       !select_sock_table_get(&sel->writers,
+				      sel->max_sock) &&
+	       !select_sock_table_get(&sel->exceptions,
+				      sel->max_sock))
+		sel->max_sock--;
 }
 
 
-
-static void select_sock_table_set_fds(struct select_sock_table *table,
-				     fd_set *fds)
+static void select_sock_call(struct select_sock_table *table, int sock,
+			     unsigned int gen)
 {
-	int i;
-
-	FD_ZERO(fds);
+	struct select_sock *s = select_sock_table_get(table, sock);
 
-	if (table->table == NULL)
+	if (s == NULL || select_sock_is_new(s, gen))
 		return;
-      uagent_printf(MSG_INFO,"select sock table set fds\n");
-	for (i = 0; i < table->count; i++)
-		FD_SET(table->table[i].sock, fds);
+	s->handler(sock, s->select_data, s->user_data);
 }
 
 
-static void select_sock_table_dispatch(struct select_sock_table *table,
-				      fd_set *fds)
+#ifdef CONFIG_SELECT_EPOLL
+static void select_epoll_dispatch(struct select_loop *sel,
+				  struct epoll_event *events, int nfds)
 {
+	unsigned int gen = sel->sock_gen;
 	int i;
 
-	if (table == NULL || table->table == NULL)
+	sel->readers.changed = 0;
+	sel->writers.changed = 0;
+	sel->exceptions.changed = 0;
+	for (i = 0; i < nfds; i++) {
+		int sock = events[i].data.fd;
+		u32 ev = events[i].events;
+
+		/*
+		 * select() reports errors and hangups as readable/writable,
+		 * keep the same semantics for the handlers.
+		 */
+		if (ev & (EPOLLERR | EPOLLHUP))
+			ev |= EPOLLIN | EPOLLOUT;
+
+		if (ev & EPOLLIN)
+			select_sock_call(&sel->readers, sock, gen);
+		if (ev & EPOLLOUT)
+			select_sock_call(&sel->writers, sock, gen);
+		if (ev & EPOLLPRI)
+			select_sock_call(&sel->exceptions, sock, gen);
+	}
+}
+#else /* CONFIG_SELECT_EPOLL */
+static void select_sock_table_dispatch(struct select_loop *sel,
+				       struct select_sock_table *table,
+				       fd_set *fds, int max_sock)
+{
+	unsigned int gen = sel->sock_gen;
+	int sock;
+
+	if (table->count == 0)
 		return;
 
 	table->changed = 0;
-	for (i = 0; i < table->count; i++) {
-		if (FD_ISSET(table->table[i].sock, fds)) {
-			table->table[i].handler(table->table[i].sock,
-						table->table[i].select_data,
-						table->table[i].user_data);
-			if (table->changed)
-				break;
-		}
+	for (sock = 0; sock <= max_sock && sock < table->size; sock++) {
+		if (FD_ISSET(sock, fds))
+			select_sock_call(table, sock, gen);
 	}
 }
+#endif /* CONFIG_SELECT_EPOLL */
 
 
 
@@ -135,7 +430,9 @@ static void select_sock_table_destroy(struct select_sock_table *table)
 {
 	if (table) {
 		int i;
-		for (i = 0; i < table->count && table->table; i++) {
+		for (i = 0; i < table->size && table->table; i++) {
+			if (table->table[i].handler == NULL)
+				continue;
 			uagent_printf(MSG_INFO, "select: remaining socket: "
 				   "sock=%d select_data=%p user_data=%p "
 				   "handler=%p",
@@ -153,33 +450,56 @@ static void select_sock_table_destroy(struct select_sock_table *table)
 }
 
 
-int select_register_read_sock(int sock, select_sock_handler handler,
-			     void *select_data, void *user_data)
+int select_loop_register_read_sock(struct select_loop *sel, int sock,
+				   select_sock_handler handler,
+				   void *select_data, void *user_data)
 {
 	uagent_printf(MSG_INFO,"Begain to register read sock %d\n",sock);
-	return select_register_sock(sock, EVENT_TYPE_READ, handler,
-				   select_data, user_data);
+	return select_loop_register_sock(sel, sock, EVENT_TYPE_READ, handler,
+					 select_data, user_data);
 }
 
 
-void select_unregister_read_sock(int sock)
+void select_loop_unregister_read_sock(struct select_loop *sel, int sock)
 {
-	select_unregister_sock(sock, EVENT_TYPE_READ);
+	select_loop_unregister_sock(sel, sock, EVENT_TYPE_READ);
 }
 
 
-static struct select_sock_table *select_get_sock_table(select_event_type type)
+int select_loop_register_sock(struct select_loop *sel, int sock,
+			      select_event_type type,
+			      select_sock_handler handler,
+			      void *select_data, void *user_data)
 {
-	switch (type) {
-	case EVENT_TYPE_READ:
-		return &uagent_select.readers;
-	case EVENT_TYPE_WRITE:
-		return &uagent_select.writers;
-	case EVENT_TYPE_EXCEPTION:
-		return &uagent_select.exceptions;
-	}
+	struct select_sock_table *table;
 
-	return NULL;
+	table = select_get_sock_table(sel, type);
+	return select_sock_table_add_sock(sel, table, sock, handler,
+					 select_data, user_data);
+}
+
+
+void select_loop_unregister_sock(struct select_loop *sel, int sock,
+				 select_event_type type)
+{
+	struct select_sock_table *table;
+
+	table = select_get_sock_table(sel, type);
+	select_sock_table_remove_sock(sel, table, sock);
+}
+
+
+int select_register_read_sock(int sock, select_sock_handler handler,
+			     void *select_data, void *user_data)
+{
+	return select_loop_register_read_sock(uagent_select, sock, handler,
+					      select_data, user_data);
+}
+
+
+void select_unregister_read_sock(int sock)
+{
+	select_loop_unregister_read_sock(uagent_select, sock);
 }
 
 
@@ -187,138 +507,360 @@ int select_register_sock(int sock, select_event_type type,
 			select_sock_handler handler,
 			void *select_data, void *user_data)
 {
-	struct select_sock_table *table;
-
-	table = select_get_sock_table(type);
-	return select_sock_table_add_sock(table, sock, handler,
+	return select_loop_register_sock(uagent_select, sock, type, handler,
 					 select_data, user_data);
 }
 
 
 void select_unregister_sock(int sock, select_event_type type)
 {
-	struct select_sock_table *table;
+	select_loop_unregister_sock(uagent_select, sock, type);
+}
+
 
-	table = select_get_sock_table(type);
-	select_sock_table_remove_sock(table, sock);
+static void select_update_now(struct select_loop *sel)
+{
+	os_get_reltime(&sel->now);
+	sel->now_stale = 0;
 }
 
 
-int select_register_timeout(unsigned int secs, unsigned int usecs,
-			   select_timeout_handler handler,
-			   void *select_data, void *user_data)
+/*
+ * Handlers called from select_run() see the time cached for the current loop
+ * iteration so that all timeouts registered while processing one wakeup are
+ * relative to the same instant. Outside the loop, read the clock.
+ */
+static int select_get_now(struct select_loop *sel, struct os_reltime *now)
 {
-	struct select_timeout *timeout, *tmp;
+	if (!sel->running && os_get_reltime(&sel->now) < 0)
+		return -1;
+	*now = sel->now;
+	return 0;
+}
+
+
+void select_loop_now(struct select_loop *sel, struct os_reltime *now)
+{
+	select_get_now(sel, now);
+}
+
+
+void select_now(struct os_reltime *now)
+{
+	select_loop_now(uagent_select, now);
+}
+
+
+/*
+ * Pending timeouts are kept in a binary min-heap ordered by expiry time, with
+ * the registration sequence number as a tie-breaker so that timeouts with the
+ * same expiry fire in the order they were registered. Each timeout records its
+ * own 1-based heap position which allows O(log n) removal through the handle
+ * without searching.
+ */
+static int select_timeout_before(const struct select_timeout *a,
+				 const struct select_timeout *b)
+{
+	if (os_reltime_before(&a->time, &b->time))
+		return 1;
+	if (os_reltime_before(&b->time, &a->time))
+		return 0;
+	return (int) (a->seq - b->seq) < 0;
+}
+
+
+static void select_timeout_heap_set(struct select_loop *sel, unsigned int pos,
+				    struct select_timeout *timeout)
+{
+	sel->timeout_heap[pos] = timeout;
+	timeout->heap_index = pos + 1;
+}
+
+
+static void select_timeout_heap_up(struct select_loop *sel, unsigned int pos)
+{
+	struct select_timeout *timeout = sel->timeout_heap[pos];
+
+	while (pos > 0) {
+		unsigned int parent = (pos - 1) / 2;
+		struct select_timeout *p = sel->timeout_heap[parent];
+
+		if (!select_timeout_before(timeout, p))
+			break;
+		select_timeout_heap_set(sel, pos, p);
+		pos = parent;
+	}
+	select_timeout_heap_set(sel, pos, timeout);
+}
+
+
+static void select_timeout_heap_down(struct select_loop *sel, unsigned int pos)
+{
+	struct select_timeout *timeout = sel->timeout_heap[pos];
+	unsigned int count = sel->timeout_count;
+
+	for (;;) {
+		unsigned int child = 2 * pos + 1;
+
+		if (child >= count)
+			break;
+		if (child + 1 < count &&
+		    select_timeout_before(sel->timeout_heap[child + 1],
+					  sel->timeout_heap[child]))
+			child++;
+		if (!select_timeout_before(sel->timeout_heap[child],
+					   timeout))
+			break;
+		select_timeout_heap_set(sel, pos, sel->timeout_heap[child]);
+		pos = child;
+	}
+	select_timeout_heap_set(sel, pos, timeout);
+}
+
+
+static int select_timeout_heap_insert(struct select_loop *sel,
+				      struct select_timeout *timeout)
+{
+	if (sel->timeout_count == sel->timeout_alloc) {
+		struct select_timeout **tmp;
+		unsigned int next = sel->timeout_alloc ?
+			sel->timeout_alloc * 2 : 16;
+
+		tmp = os_realloc_array(sel->timeout_heap, next,
+				       sizeof(struct select_timeout *));
+		if (tmp == NULL)
+			return -1;
+		sel->timeout_heap = tmp;
+		sel->timeout_alloc = next;
+	}
+
+	timeout->seq = sel->timeout_seq++;
+	select_timeout_heap_set(sel, sel->timeout_count++, timeout);
+	select_timeout_heap_up(sel, timeout->heap_index - 1);
+	return 0;
+}
+
+
+static void select_timeout_heap_delete(struct select_loop *sel,
+				       struct select_timeout *timeout)
+{
+	unsigned int pos = timeout->heap_index - 1;
+	struct select_timeout *last;
+
+	last = sel->timeout_heap[--sel->timeout_count];
+	timeout->heap_index = 0;
+	if (last == timeout)
+		return;
+	select_timeout_heap_set(sel, pos, last);
+	select_timeout_heap_up(sel, pos);
+	select_timeout_heap_down(sel, last->heap_index - 1);
+}
+
+
+static struct select_timeout * select_timeout_first(struct select_loop *sel)
+{
+	if (sel->timeout_count == 0)
+		return NULL;
+	return sel->timeout_heap[0];
+}
+
+
+void select_timeout_init(struct select_timeout *timeout,
+			 select_timeout_handler handler,
+			 void *select_data, void *user_data)
+{
+	os_memset(timeout, 0, sizeof(*timeout));
+	timeout->handler = handler;
+	timeout->select_data = select_data;
+	timeout->user_data = user_data;
+}
+
+
+int select_loop_timeout_arm(struct select_loop *sel,
+			    struct select_timeout *timeout,
+			    unsigned int secs, unsigned int usecs)
+{
+	struct os_reltime expiry;
 	os_time_t now_sec;
 
-	timeout = os_zalloc(sizeof(*timeout));
-	if (timeout == NULL)
+	if (select_get_now(sel, &expiry) < 0)
 		return -1;
-	if (os_get_time(&timeout->time) < 0) {
-		os_free(timeout);
-		return -1;
-	}
-	now_sec = timeout->time.sec;
-	timeout->time.sec += secs;
-	if (timeout->time.sec < now_sec) {
+	now_sec = expiry.sec;
+	expiry.sec += secs;
+	if (expiry.sec < now_sec) {
 		/*
 		 * Integer overflow - assume long enough timeout to be assumed
 		 * to be infinite, i.e., the timeout would never happen.
 		 */
 		uagent_printf(MSG_INFO, "select: Too long timeout (secs=%u) to "
 			   "ever happen - ignore it", secs);
-		os_free(timeout);
-		return 0;
+		select_timeout_disarm(timeout);
+		return 1;
 	}
-	timeout->time.usec += usecs;
-	while (timeout->time.usec >= 1000000) {
-		timeout->time.sec++;
-		timeout->time.usec -= 1000000;
-	}
-	timeout->select_data = select_data;
-	timeout->user_data = user_data;
-	timeout->handler = handler;
+	os_reltime_add_usec(&expiry, usecs);
+
+	if (select_timeout_pending(timeout))
+		select_timeout_heap_delete(timeout->sel, timeout);
+	timeout->time = expiry;
+	timeout->sel = sel;
+	return select_timeout_heap_insert(sel, timeout);
+}
+
+
+int select_timeout_arm(struct select_timeout *timeout, unsigned int secs,
+		       unsigned int usecs)
+{
+	return select_loop_timeout_arm(uagent_select, timeout, secs, usecs);
+}
+
+
+int select_timeout_disarm(struct select_timeout *timeout)
+{
+	if (!select_timeout_pending(timeout))
+		return 0;
+	select_timeout_heap_delete(timeout->sel, timeout);
+	return 1;
+}
+
+
+int select_loop_register_timeout(struct select_loop *sel, unsigned int secs,
+				 unsigned int usecs,
+				 select_timeout_handler handler,
+				 void *select_data, void *user_data)
+{
+	struct select_timeout *timeout;
+	int res;
+
+	timeout = os_malloc(sizeof(*timeout));
+	if (timeout == NULL)
+		return -1;
+	select_timeout_init(timeout, handler, select_data, user_data);
+	timeout->flags = SELECT_TIMEOUT_ALLOCATED;
 	/*wpa_trace_add_ref(timeout, uagent_select, select_data);
 	wpa_trace_add_ref(timeout, user, user_data);
 	wpa_trace_record(timeout);*/
 
-	/* Maintain timeouts in order of increasing time */
-	dl_list_for_each(tmp, &uagent_select.timeout, struct select_timeout, list) {
-		if (os_time_before(&timeout->time, &tmp->time)) {
-			dl_list_add(tmp->list.prev, &timeout->list);
-			return 0;
-		}
+	res = select_loop_timeout_arm(sel, timeout, secs, usecs);
+	if (res != 0) {
+		os_free(timeout);
+		return res < 0 ? -1 : 0;
 	}
-	dl_list_add_tail(&uagent_select.timeout, &timeout->list);
 
 	return 0;
 }
 
 
+int select_register_timeout(unsigned int secs, unsigned int usecs,
+			   select_timeout_handler handler,
+			   void *select_data, void *user_data)
+{
+	return select_loop_register_timeout(uagent_select, secs, usecs, handler,
+					    select_data, user_data);
+}
+
+
 static void select_remove_timeout(struct select_timeout *timeout)
 {
-	dl_list_del(&timeout->list);
+	select_timeout_disarm(timeout);
 	/*wpa_trace_remove_ref(timeout, uagent_select, timeout->select_data);
 	wpa_trace_remove_ref(timeout, user, timeout->user_data);*/
-	os_free(timeout);
+	if (timeout->flags & SELECT_TIMEOUT_ALLOCATED)
+		os_free(timeout);
 }
 
 
-int select_cancel_timeout(select_timeout_handler handler,
-			 void *select_data, void *user_data)
+int select_loop_cancel_timeout(struct select_loop *sel,
+			       select_timeout_handler handler,
+			       void *select_data, void *user_data)
 {
-	struct select_timeout *timeout, *prev;
+	unsigned int i, kept = 0;
 	int removed = 0;
 
-	dl_list_for_each_safe(timeout, prev, &uagent_select.timeout,
-			      struct select_timeout, list) {
+	/*
+	 * Wildcard matching needs a full scan anyway, so compact the heap
+	 * array in place and rebuild the heap property once at the end.
+	 */
+	for (i = 0; i < sel->timeout_count; i++) {
+		struct select_timeout *timeout = sel->timeout_heap[i];
+
 		if (timeout->handler == handler &&
 		    (timeout->select_data == select_data ||
 		     select_data == SELECT_ALL_CTX) &&
 		    (timeout->user_data == user_data ||
 		     user_data == SELECT_ALL_CTX)) {
-			select_remove_timeout(timeout);
+			timeout->heap_index = 0;
+			if (timeout->flags & SELECT_TIMEOUT_ALLOCATED)
+				os_free(timeout);
 			removed++;
+			continue;
 		}
+		select_timeout_heap_set(sel, kept++, timeout);
+	}
+
+	if (removed) {
+		sel->timeout_count = kept;
+		for (i = kept / 2; i > 0; i--)
+			select_timeout_heap_down(sel, i - 1);
 	}
 
 	return removed;
 }
 
 
-int select_cancel_timeout_one(select_timeout_handler handler,
-			     void *select_data, void *user_data,
-			     struct os_time *remaining)
+int select_cancel_timeout(select_timeout_handler handler,
+			 void *select_data, void *user_data)
 {
-	struct select_timeout *timeout, *prev;
-	int removed = 0;
-	struct os_time now;
+	return select_loop_cancel_timeout(uagent_select, handler, select_data,
+					  user_data);
+}
+
 
-	os_get_time(&now);
+int select_loop_cancel_timeout_one(struct select_loop *sel,
+				   select_timeout_handler handler,
+				   void *select_data, void *user_data,
+				   struct os_time *remaining)
+{
+	unsigned int i;
+	struct os_reltime now;
+
+	select_get_now(sel, &now);
 	remaining->sec = remaining->usec = 0;
 
-	dl_list_for_each_safe(timeout, prev, &uagent_select.timeout,
-			      struct select_timeout, list) {
+	for (i = 0; i < sel->timeout_count; i++) {
+		struct select_timeout *timeout = sel->timeout_heap[i];
+
 		if (timeout->handler == handler &&
 		    (timeout->select_data == select_data) &&
 		    (timeout->user_data == user_data)) {
-			removed = 1;
-			if (os_time_before(&now, &timeout->time))
-				os_time_sub(&timeout->time, &now, remaining);
+			if (os_reltime_before(&now, &timeout->time))
+				os_reltime_sub(&timeout->time, &now, remaining);
 			select_remove_timeout(timeout);
-			break;
+			return 1;
 		}
 	}
-	return removed;
+	return 0;
 }
 
 
-int select_is_timeout_registered(select_timeout_handler handler,
-				void *select_data, void *user_data)
+int select_cancel_timeout_one(select_timeout_handler handler,
+			     void *select_data, void *user_data,
+			     struct os_time *remaining)
 {
-	struct select_timeout *tmp;
+	return select_loop_cancel_timeout_one(uagent_select, handler,
+					      select_data, user_data,
+					      remaining);
+}
+
+
+int select_loop_is_timeout_registered(struct select_loop *sel,
+				      select_timeout_handler handler,
+				      void *select_data, void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < sel->timeout_count; i++) {
+		struct select_timeout *tmp = sel->timeout_heap[i];
 
-	dl_list_for_each(tmp, &uagent_select.timeout, struct select_timeout, list) {
 		if (tmp->handler == handler &&
 		    tmp->select_data == select_data &&
 		    tmp->user_data == user_data)
@@ -328,6 +870,14 @@ int select_is_timeout_registered(select_timeout_handler handler,
 	return 0;
 }
 
+
+int select_is_timeout_registered(select_timeout_handler handler,
+				void *select_data, void *user_data)
+{
+	return select_loop_is_timeout_registered(uagent_select, handler,
+						 select_data, user_data);
+}
+
 #ifdef SIGNAL_HANDLE
 #ifndef CONFIG_NATIVE_WINDOWS
 #ifdef SEC_PRODUCT_FEATURE_WLAN_CHINA_WAPI
@@ -438,92 +988,386 @@ int select_register_signal_reconfig(select_signal_handler handler,
 }
 #endif
 
-void select_run(void)
+/*
+ * Fire every timeout that has expired at the current time. Timeouts that are
+ * registered by the handlers while this runs are left for the next pass even
+ * if they are already due, so that a handler re-arming itself with a zero
+ * delay cannot starve the sockets. sel->timeout_batch_max limits the
+ * number of handlers called per pass; anything left over makes the next
+ * select() return immediately.
+ */
+static void select_process_timeouts(struct select_loop *sel)
+{
+	struct select_timeout *timeout;
+	struct os_reltime *now = &sel->now;
+	struct os_reltime late;
+	unsigned int start_seq = sel->timeout_seq;
+	unsigned int fired = 0;
+
+	while ((timeout = select_timeout_first(sel)) != NULL) {
+		void *select_data, *user_data;
+		select_timeout_handler handler;
+
+		if (os_reltime_before(now, &timeout->time))
+			break;
+		if ((int) (timeout->seq - start_seq) >= 0)
+			break;
+		if (sel->timeout_batch_max &&
+		    fired >= sel->timeout_batch_max)
+			break;
+
+		os_reltime_sub(now, &timeout->time, &late);
+		sel->timeout_stats.fired++;
+		if (late.sec > 0 || late.usec >= SELECT_TIMEOUT_LATE_USEC) {
+			struct select_timeout_stats *stats =
+				&sel->timeout_stats;
+
+			stats->late++;
+			stats->late_total.sec += late.sec;
+			stats->late_total.usec += late.usec;
+			if (stats->late_total.usec >= 1000000) {
+				stats->late_total.sec++;
+				stats->late_total.usec -= 1000000;
+			}
+			if (os_reltime_before(&stats->late_max, &late))
+				stats->late_max = late;
+		}
+
+		select_data = timeout->select_data;
+		user_data = timeout->user_data;
+		handler = timeout->handler;
+		select_remove_timeout(timeout);
+		handler(select_data, user_data);
+		fired++;
+	}
+	if (fired)
+		sel->now_stale = 1;
+}
+
+
+/*
+ * Other threads reach a loop through a self-pipe whose read end is registered
+ * like any other socket. select_loop_post() queues the callback under
+ * post_lock and writes a single byte to the pipe unless a wakeup is already
+ * pending, so a burst of posts costs one wakeup of the loop.
+ */
+static void select_loop_wakeup(struct select_loop *sel)
+{
+	char c = 0;
+
+	if (write(sel->wakeup_fd[1], &c, 1) < 0 && errno != EAGAIN)
+		uagent_printf(MSG_ERROR, "select: wakeup write failed: %s",
+			      strerror(errno));
+}
+
+
+static void select_loop_wakeup_receive(int sock, void *select_data,
+				       void *user_data)
+{
+	struct select_loop *sel = select_data;
+	struct select_post *post, *n;
+	struct dl_list posts;
+	char buf[64];
+
+	while (read(sock, buf, sizeof(buf)) > 0)
+		;
+
+	dl_list_init(&posts);
+	pthread_mutex_lock(&sel->post_lock);
+	sel->wakeup_pending = 0;
+	if (sel->terminate_request) {
+		sel->terminate_request = 0;
+		sel->terminate = 1;
+	}
+	dl_list_for_each_safe(post, n, &sel->posts, struct select_post, list) {
+		dl_list_del(&post->list);
+		dl_list_add_tail(&posts, &post->list);
+	}
+	pthread_mutex_unlock(&sel->post_lock);
+
+	dl_list_for_each_safe(post, n, &posts, struct select_post, list) {
+		dl_list_del(&post->list);
+		post->handler(post->select_data, post->user_data);
+		os_free(post);
+	}
+}
+
+
+int select_loop_post(struct select_loop *sel, select_timeout_handler handler,
+		     void *select_data, void *user_data)
+{
+	struct select_post *post;
+
+	post = os_malloc(sizeof(*post));
+	if (post == NULL)
+		return -1;
+	post->handler = handler;
+	post->select_data = select_data;
+	post->user_data = user_data;
+
+	pthread_mutex_lock(&sel->post_lock);
+	dl_list_add_tail(&sel->posts, &post->list);
+	if (!sel->wakeup_pending) {
+		sel->wakeup_pending = 1;
+		select_loop_wakeup(sel);
+	}
+	pthread_mutex_unlock(&sel->post_lock);
+	return 0;
+}
+
+
+void select_loop_set_persistent(struct select_loop *sel, int persistent)
 {
+	sel->persistent = persistent;
+}
+
+
+/* The wakeup pipe is registered internally and does not keep a loop alive */
+static int select_loop_active(struct select_loop *sel)
+{
+	return sel->persistent || sel->timeout_count > 0 || sel->count > 1;
+}
+
 
+struct select_loop * select_loop_new(void)
+{
+	struct select_loop *sel;
+	int i;
+
+	sel = os_zalloc(sizeof(*sel));
+	if (sel == NULL)
+		return NULL;
+	sel->max_sock = -1;
+	sel->readers.type = EVENT_TYPE_READ;
+	sel->writers.type = EVENT_TYPE_WRITE;
+	sel->exceptions.type = EVENT_TYPE_EXCEPTION;
+	dl_list_init(&sel->posts);
+#ifdef CONFIG_SELECT_EPOLL
+	sel->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (sel->epollfd < 0) {
+		uagent_printf(MSG_ERROR, "select: epoll_create1 failed: %s",
+			      strerror(errno));
+		os_free(sel);
+		return NULL;
+	}
+#else /* CONFIG_SELECT_EPOLL */
+	FD_ZERO(&sel->readers.fds);
+	FD_ZERO(&sel->writers.fds);
+	FD_ZERO(&sel->exceptions.fds);
+#endif /* CONFIG_SELECT_EPOLL */
+
+	if (pipe(sel->wakeup_fd) < 0) {
+		uagent_printf(MSG_ERROR, "select: wakeup pipe failed: %s",
+			      strerror(errno));
+		goto fail;
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(sel->wakeup_fd[i], F_SETFL, O_NONBLOCK);
+		fcntl(sel->wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+	}
+	if (select_sock_table_add_sock(sel, &sel->readers, sel->wakeup_fd[0],
+				       select_loop_wakeup_receive, sel,
+				       NULL) < 0) {
+		close(sel->wakeup_fd[0]);
+		close(sel->wakeup_fd[1]);
+		goto fail;
+	}
+	pthread_mutex_init(&sel->post_lock, NULL);
+	return sel;
+
+fail:
+#ifdef CONFIG_SELECT_EPOLL
+	close(sel->epollfd);
+	os_free(sel->epoll_events);
+	os_free(sel->epoll_mask);
+#endif /* CONFIG_SELECT_EPOLL */
+	os_free(sel->readers.table);
+	os_free(sel);
+	return NULL;
+}
+
+
+void select_loop_set_timeout_batch(struct select_loop *sel, unsigned int max)
+{
+	sel->timeout_batch_max = max;
+}
+
+
+void select_set_timeout_batch(unsigned int max)
+{
+	select_loop_set_timeout_batch(uagent_select, max);
+}
+
+
+void select_loop_get_timeout_stats(struct select_loop *sel,
+				   struct select_timeout_stats *stats)
+{
+	*stats = sel->timeout_stats;
+}
+
+
+void select_get_timeout_stats(struct select_timeout_stats *stats)
+{
+	select_loop_get_timeout_stats(uagent_select, stats);
+}
+
+
+void select_loop_run(struct select_loop *sel)
+{
+	struct select_loop *prev = uagent_select;
+#ifdef CONFIG_SELECT_EPOLL
+	int timeout_ms = -1;
+#else /* CONFIG_SELECT_EPOLL */
 	fd_set *rfds, *wfds, *efds;
 	struct timeval _tv;
+	int max_sock;
+#endif /* CONFIG_SELECT_EPOLL */
 	int res;
-	struct os_time tv, now;
+	struct os_reltime tv;
+#ifndef CONFIG_SELECT_EPOLL
 	rfds = os_malloc(sizeof(*rfds));
 	wfds = os_malloc(sizeof(*wfds));
 	efds = os_malloc(sizeof(*efds));
 	if (rfds == NULL || wfds == NULL || efds == NULL)
 		goto out;
-	while (!uagent_select.terminate &&
-	       (!dl_list_empty(&uagent_select.timeout) || uagent_select.readers.count > 0 ||
-		uagent_select.writers.count > 0 || uagent_select.exceptions.count > 0)) {
+#endif /* CONFIG_SELECT_EPOLL */
+	uagent_select = sel;
+	sel->running = 1;
+	select_update_now(sel);
+	while (!sel->terminate && select_loop_active(sel)) {
 		struct select_timeout *timeout;
-		timeout = dl_list_first(&uagent_select.timeout, struct select_timeout,
-					list);
+
+		/*
+		 * The cached time is taken once per iteration right after the
+		 * wait returns. Refresh it before blocking only if handlers ran
+		 * since then, otherwise their run time would delay timeouts.
+		 */
+		if (sel->now_stale)
+			select_update_now(sel);
+		timeout = select_timeout_first(sel);
 		if (timeout) {
-			os_get_time(&now);
-			if (os_time_before(&now, &timeout->time))
-				os_time_sub(&timeout->time, &now, &tv);
+			struct os_reltime *now = &sel->now;
+
+			if (os_reltime_before(now, &timeout->time))
+				os_reltime_sub(&timeout->time, now, &tv);
 			else
 				tv.sec = tv.usec = 0;
+#ifdef CONFIG_SELECT_EPOLL
+			/* Round up so that we never wake up before the timeout */
+			timeout_ms = tv.sec * 1000 + (tv.usec + 999) / 1000;
+#else /* CONFIG_SELECT_EPOLL */
 			_tv.tv_sec = tv.sec;
 			_tv.tv_usec = tv.usec;
+#endif /* CONFIG_SELECT_EPOLL */
 		}
-
-		select_sock_table_set_fds(&uagent_select.readers, rfds);
-		select_sock_table_set_fds(&uagent_select.writers, wfds);
-		select_sock_table_set_fds(&uagent_select.exceptions, efds);
-		res = select(uagent_select.max_sock + 1, rfds, wfds, efds,
+#ifdef CONFIG_SELECT_EPOLL
+		else
+			timeout_ms = -1;
+
+		if (sel->count == 0) {
+			/* epoll_wait() rejects maxevents == 0 */
+			if (timeout_ms > 0)
+				os_sleep(timeout_ms / 1000,
+					 (timeout_ms % 1000) * 1000);
+			res = 0;
+		} else {
+			res = epoll_wait(sel->epollfd,
+					 sel->epoll_events,
+					 sel->count, timeout_ms);
+		}
+		if (res < 0 && errno != EINTR && errno != 0) {
+			perror("epoll_wait");
+			goto out;
+		}
+#else /* CONFIG_SELECT_EPOLL */
+		max_sock = sel->max_sock;
+		*rfds = sel->readers.fds;
+		*wfds = sel->writers.fds;
+		*efds = sel->exceptions.fds;
+		res = select(max_sock + 1, rfds, wfds, efds,
 			     timeout ? &_tv : NULL);
 		if (res < 0 && errno != EINTR && errno != 0) {
 			perror("select");
 			goto out;
 		}
+#endif /* CONFIG_SELECT_EPOLL */
 		/*select_process_pending_signals();*/
+		select_update_now(sel);
 
 		/* check if some registered timeouts have occurred */
-		timeout = dl_list_first(&uagent_select.timeout, struct select_timeout,
-					list);
-		if (timeout) {
-			os_get_time(&now);
-			if (!os_time_before(&now, &timeout->time)) {
-				void *select_data = timeout->select_data;
-				void *user_data = timeout->user_data;
-				select_timeout_handler handler =
-					timeout->handler;
-				select_remove_timeout(timeout);
-				handler(select_data, user_data);
-			}
-
-		}
+		select_process_timeouts(sel);
 
 		if (res <= 0)
 			continue;
 
-		select_sock_table_dispatch(&uagent_select.readers, rfds);
-		select_sock_table_dispatch(&uagent_select.writers, wfds);
-		select_sock_table_dispatch(&uagent_select.exceptions, efds);
+		sel->now_stale = 1;
+
+#ifdef CONFIG_SELECT_EPOLL
+		select_epoll_dispatch(sel, sel->epoll_events, res);
+#else /* CONFIG_SELECT_EPOLL */
+		select_sock_table_dispatch(sel, &sel->readers, rfds,
+					   max_sock);
+		select_sock_table_dispatch(sel, &sel->writers, wfds,
+					   max_sock);
+		select_sock_table_dispatch(sel, &sel->exceptions, efds,
+					   max_sock);
+#endif /* CONFIG_SELECT_EPOLL */
 	}
 
-	uagent_select.terminate = 0;
+	sel->terminate = 0;
 out:
+	sel->running = 0;
+	uagent_select = prev;
+#ifndef CONFIG_SELECT_EPOLL
 	os_free(rfds);
 	os_free(wfds);
 	os_free(efds);
+#endif /* CONFIG_SELECT_EPOLL */
 	return;
 }
 
 
+void select_run(void)
+{
+	select_loop_run(uagent_select);
+}
+
+
+void select_loop_terminate(struct select_loop *sel)
+{
+	if (sel == uagent_select) {
+		sel->terminate = 1;
+		return;
+	}
+
+	/* Another thread; the loop picks this up in its wakeup handler */
+	pthread_mutex_lock(&sel->post_lock);
+	sel->terminate_request = 1;
+	if (!sel->wakeup_pending) {
+		sel->wakeup_pending = 1;
+		select_loop_wakeup(sel);
+	}
+	pthread_mutex_unlock(&sel->post_lock);
+}
+
+
 void select_terminate(void)
 {
-	uagent_select.terminate = 1;
+	select_loop_terminate(uagent_select);
 }
 
 
-void select_destroy(void)
+void select_loop_free(struct select_loop *sel)
 {
-	struct select_timeout *timeout, *prev;
-	struct os_time now;
+	struct select_timeout *timeout;
+	struct select_post *post, *n;
+	struct os_reltime now;
+
+	if (sel == NULL)
+		return;
 
-	os_get_time(&now);
-	dl_list_for_each_safe(timeout, prev, &uagent_select.timeout,
-			      struct select_timeout, list) {
+	select_get_now(sel, &now);
+	while ((timeout = select_timeout_first(sel)) != NULL) {
 		int sec, usec;
 		sec = timeout->time.sec - now.sec;
 		usec = timeout->time.usec - now.usec;
@@ -540,21 +1384,70 @@ void select_destroy(void)
 		wpa_trace_dump("select timeout", timeout);*/
 		select_remove_timeout(timeout);
 	}
-	select_sock_table_destroy(&uagent_select.readers);
-	select_sock_table_destroy(&uagent_select.writers);
-	select_sock_table_destroy(&uagent_select.exceptions);
-	os_free(uagent_select.signals);
+	os_free(sel->timeout_heap);
+	select_loop_unregister_read_sock(sel, sel->wakeup_fd[0]);
+	close(sel->wakeup_fd[0]);
+	close(sel->wakeup_fd[1]);
+	dl_list_for_each_safe(post, n, &sel->posts, struct select_post, list) {
+		dl_list_del(&post->list);
+		os_free(post);
+	}
+	pthread_mutex_destroy(&sel->post_lock);
+	select_sock_table_destroy(&sel->readers);
+	select_sock_table_destroy(&sel->writers);
+	select_sock_table_destroy(&sel->exceptions);
+	os_free(sel->signals);
+
+#ifdef CONFIG_SELECT_EPOLL
+	if (sel->epollfd >= 0)
+		close(sel->epollfd);
+	os_free(sel->epoll_events);
+	os_free(sel->epoll_mask);
+#endif /* CONFIG_SELECT_EPOLL */
 
 #ifdef CONFIG_select_POLL
-	os_free(uagent_select.pollfds);
-	os_free(uagent_select.pollfds_map);
+	os_free(sel->pollfds);
+	os_free(sel->pollfds_map);
 #endif /* CONFIG_select_POLL */
+	os_free(sel);
+}
+
+
+int select_init(void)
+{
+	struct select_loop *sel;
+
+	sel = select_loop_new();
+	if (sel == NULL)
+		return -1;
+	uagent_select = sel;
+	uagent_printf(MSG_INFO,"select init is okay.\n");
+	return 0;
+}
+
+
+void select_destroy(void)
+{
+	select_loop_free(uagent_select);
+	uagent_select = NULL;
+}
+
+
+struct select_loop * select_loop_current(void)
+{
+	return uagent_select;
+}
+
+
+int select_loop_terminated(struct select_loop *sel)
+{
+	return sel->terminate;
 }
 
 
 int select_terminated(void)
 {
-	return uagent_select.terminate;
+	return select_loop_terminated(uagent_select);
 }
 
 
@@ -585,6 +1478,8 @@ void select_wait_for_read_sock(int sock)
 #ifdef SEC_PRODUCT_FEATURE_WLAN_CHINA_WAPI
 void * select_get_user_data(void)
 {
-	return uagent_select.user_data;
+	struct select_loop *sel = uagent_select;
+
+	return sel->user_data;
 }
 #endif
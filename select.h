@@ -7,11 +7,13 @@
  *
  * This file defines an event loop interface that supports processing events
  * from registered timeouts (i.e., do something after N seconds), sockets
- * (e.g., a new packet available for reading), and signals. eloop.c is an
+ * (e.g., a new packet available for reading), and signals. select.c is an
  * implementation of this interface using select() and sockets. This is
- * suitable for most UNIX/POSIX systems. When porting to other operating
- * systems, it may be necessary to replace that implementation with OS specific
- * mechanisms.
+ * suitable for most UNIX/POSIX systems. On Linux, building with
+ * CONFIG_SELECT_EPOLL replaces select() with epoll so that the cost of a
+ * wakeup depends on the number of ready sockets and not on the highest
+ * registered descriptor. When porting to other operating systems, it may be
+ * necessary to replace that implementation with OS specific mechanisms.
  */
 #include "list.h"
 #include "os.h"
@@ -54,10 +56,12 @@ typedef void (*select_timeout_handler)(void *server_data, void *uagent_ctx);
 
 typedef void (*select_signal_handler)(void *server_data, void *uagent_ctx);
 /**
- * select_init() - Initialize global select data
+ * select_init() - Initialize select data for the calling thread
  * Returns: 0 on success, -1 on failure
  *
- * This function must be called before any other select_* function.
+ * This function must be called before any other select_* function. Each
+ * thread that calls select_init() gets its own event loop, and the other
+ * select_* functions operate on the loop of the thread they are called from.
  */
 
 int select_init(void);
@@ -79,6 +83,44 @@ int select_init(void);
 int select_register_read_sock(int sock, select_sock_handler handler,
 			     void *select_data, void *user_data);
 
+/**
+ * select_unregister_read_sock - Unregister handler for read events
+ * @sock: File descriptor number for the socket
+ *
+ * Unregister a read socket notifier that was previously registered with
+ * select_register_read_sock().
+ */
+void select_unregister_read_sock(int sock);
+
+/**
+ * select_register_sock - Register handler for socket events
+ * @sock: File descriptor number for the socket
+ * @type: Type of event to wait for
+ * @handler: Callback function to be called when the event is triggered
+ * @select_data: Callback context data (server_ctx)
+ * @user_data: Callback context data (uagent_ctx)
+ * Returns: 0 on success, -1 on failure
+ *
+ * Register an event notifier for the given socket's file descriptor. The
+ * handler function will be called whenever the that event is triggered for
+ * the socket. The handler function is responsible for clearing the event
+ * after having processed it in order to avoid select from calling the handler
+ * again for the same event.
+ */
+int select_register_sock(int sock, select_event_type type,
+			select_sock_handler handler,
+			void *select_data, void *user_data);
+
+/**
+ * select_unregister_sock - Unregister handler for socket events
+ * @sock: File descriptor number for the socket
+ * @type: Type of event for which sock was registered
+ *
+ * Unregister a socket event notifier that was previously registered with
+ * select_register_sock().
+ */
+void select_unregister_sock(int sock, select_event_type type);
+
 /**
  * eloop_register_timeout - Register timeout
  * @secs: Number of seconds to the timeout
@@ -137,6 +179,96 @@ int select_cancel_timeout_one(select_timeout_handler handler,
 int select_is_timeout_registered(select_timeout_handler handler,
 				void *server_data, void *uagent_data);
 
+struct select_timeout;
+struct select_loop;
+
+/**
+ * select_timeout_init - Initialize a caller owned timeout
+ * @timeout: Timeout to initialize
+ * @handler: Callback function to be called when timeout occurs
+ * @select_data: Callback context data (server_ctx)
+ * @user_data: Callback context data (uagent_ctx)
+ *
+ * Prepare a timeout that is embedded in a caller owned structure, e.g., a
+ * per-connection keepalive timer. The timeout is idle until it is armed with
+ * select_timeout_arm(). The memory must stay valid while the timeout is
+ * pending; select never frees it.
+ */
+void select_timeout_init(struct select_timeout *timeout,
+			 select_timeout_handler handler,
+			 void *select_data, void *user_data);
+
+/**
+ * select_timeout_arm - Schedule or reschedule a caller owned timeout
+ * @timeout: Timeout initialized with select_timeout_init()
+ * @secs: Number of seconds to the timeout
+ * @usecs: Number of microseconds to the timeout
+ * Returns: 0 on success, 1 if the timeout is too long to ever happen (it is
+ * left idle), -1 on failure
+ *
+ * If the timeout is already pending, it is moved to the new expiry time. This
+ * is O(log n) in the number of pending timeouts.
+ */
+int select_timeout_arm(struct select_timeout *timeout, unsigned int secs,
+		       unsigned int usecs);
+
+/**
+ * select_timeout_disarm - Cancel a caller owned timeout
+ * @timeout: Timeout initialized with select_timeout_init()
+ * Returns: 1 if the timeout was pending, 0 if it was idle
+ *
+ * This is O(log n) in the number of pending timeouts and does not need to
+ * search for the timeout like select_cancel_timeout() does.
+ */
+int select_timeout_disarm(struct select_timeout *timeout);
+
+/**
+ * select_set_timeout_batch - Limit the number of timeouts fired per pass
+ * @max: Maximum number of timeout handlers to call per loop iteration, or 0
+ *	for no limit (default)
+ *
+ * All timeouts that have expired are normally fired before the sockets are
+ * checked again. A limit keeps a large backlog of expired timeouts from
+ * delaying socket handlers; the remaining ones are fired on the following
+ * iterations without waiting in select().
+ */
+void select_set_timeout_batch(unsigned int max);
+
+/* Timeouts firing later than this after their expiry are counted as late */
+#define SELECT_TIMEOUT_LATE_USEC 10000
+
+/**
+ * struct select_timeout_stats - Timeout expiry statistics
+ * @fired: Number of timeout handlers called
+ * @late: Number of timeouts fired more than %SELECT_TIMEOUT_LATE_USEC after
+ *	their expiry time
+ * @late_total: Sum of the lateness of the late timeouts
+ * @late_max: Largest lateness seen
+ */
+struct select_timeout_stats {
+	unsigned long fired;
+	unsigned long late;
+	struct os_reltime late_total;
+	struct os_reltime late_max;
+};
+
+/**
+ * select_get_timeout_stats - Get timeout expiry statistics
+ * @stats: Buffer for the statistics
+ */
+void select_get_timeout_stats(struct select_timeout_stats *stats);
+
+/**
+ * select_now - Get the event loop time
+ * @now: Buffer for the time
+ *
+ * Returns the monotonic time (see os_get_reltime()) the loop cached for the
+ * current iteration when called from a select handler, or the current time
+ * when called outside select_run(). Timeouts registered from handlers are
+ * relative to this time.
+ */
+void select_now(struct os_reltime *now);
+
 /**
  * select_run - Start the select loop
  *
@@ -157,8 +289,8 @@ void select_terminate(void);
 /**
  * select_destroy - Free any resources allocated for the event loop
  *
- * After calling eloop_destroy(), other eloop_* functions must not be called
- * before re-running eloop_init().
+ * After calling select_destroy(), other select_* functions must not be called
+ * from the same thread before re-running select_init().
  */
 void select_destroy(void);
 
@@ -181,53 +313,143 @@ int select_terminated(void);
  */
 void select_wait_for_read_sock(int sock);
 
-struct select_sock {
-	int sock;
-	void *select_data;
-	void *user_data;
-	select_sock_handler handler;
-};
+/* select_timeout::flags - timeout was allocated by select_register_timeout() */
+#define SELECT_TIMEOUT_ALLOCATED 0x01
 
 struct select_timeout {
-	struct dl_list list;
-	struct os_time time;
+	struct select_loop *sel; /* loop the timeout is pending on */
+	struct os_reltime time;
 	void *select_data;
 	void *user_data;
 	select_timeout_handler handler;
+	unsigned int heap_index; /* 1-based position in the heap, 0 if idle */
+	unsigned int seq; /* registration order for equal expiry times */
+	unsigned int flags;
 };
 
-struct select_signal {
-	int sig;
-	void *user_data;
-	select_signal_handler handler;
-	int signaled;
-};
+/**
+ * select_timeout_pending - Check whether a timeout is scheduled
+ * @timeout: Timeout initialized with select_timeout_init()
+ * Returns: 1 if the timeout is pending, 0 if it is idle or has already fired
+ */
+static inline int select_timeout_pending(const struct select_timeout *timeout)
+{
+	return timeout->heap_index != 0;
+}
 
-struct select_sock_table {
-	int count;
-	struct select_sock *table;
-	int changed;
-};
+/*
+ * Explicit event loop handles
+ *
+ * The select_* functions above operate on the loop of the calling thread that
+ * was created with select_init(). The select_loop_* functions take the loop
+ * as an argument instead, so that a thread can create and drive any number of
+ * loops, e.g., a worker loop that runs blocking operations off the main loop.
+ * Except for select_loop_post() and select_loop_terminate(), a loop must only
+ * be used from the thread that runs it.
+ */
 
-struct select_data {
-	void *user_data;
-	int max_sock;
+/**
+ * select_loop_new - Allocate a new event loop
+ * Returns: Pointer to the loop or %NULL on failure
+ */
+struct select_loop * select_loop_new(void);
 
-	int count; /* sum of all table counts */
-	struct select_sock_table readers;
-	struct select_sock_table writers;
-	struct select_sock_table exceptions;
+/**
+ * select_loop_free - Free an event loop
+ * @loop: Loop from select_loop_new()
+ *
+ * Remaining timeouts are freed and posted callbacks that have not yet been
+ * called are dropped. The loop must not be running.
+ */
+void select_loop_free(struct select_loop *loop);
 
-	struct dl_list timeout;
+/**
+ * select_loop_current - Get the event loop of the calling thread
+ * Returns: The loop currently run by select_loop_run() in this thread, or the
+ * loop created by select_init(), or %NULL if there is none
+ */
+struct select_loop * select_loop_current(void);
 
-	int signal_count;
-	struct select_signal *signals;
-	int signaled;
-	int pending_terminate;
+int select_loop_register_sock(struct select_loop *loop, int sock,
+			      select_event_type type,
+			      select_sock_handler handler,
+			      void *select_data, void *user_data);
+void select_loop_unregister_sock(struct select_loop *loop, int sock,
+				 select_event_type type);
+int select_loop_register_read_sock(struct select_loop *loop, int sock,
+				   select_sock_handler handler,
+				   void *select_data, void *user_data);
+void select_loop_unregister_read_sock(struct select_loop *loop, int sock);
+int select_loop_register_timeout(struct select_loop *loop, unsigned int secs,
+				 unsigned int usecs,
+				 select_timeout_handler handler,
+				 void *select_data, void *user_data);
+int select_loop_cancel_timeout(struct select_loop *loop,
+			       select_timeout_handler handler,
+			       void *select_data, void *user_data);
+int select_loop_cancel_timeout_one(struct select_loop *loop,
+				   select_timeout_handler handler,
+				   void *select_data, void *user_data,
+				   struct os_time *remaining);
+int select_loop_is_timeout_registered(struct select_loop *loop,
+				      select_timeout_handler handler,
+				      void *select_data, void *user_data);
+int select_loop_timeout_arm(struct select_loop *loop,
+			    struct select_timeout *timeout,
+			    unsigned int secs, unsigned int usecs);
+void select_loop_now(struct select_loop *loop, struct os_reltime *now);
+void select_loop_set_timeout_batch(struct select_loop *loop, unsigned int max);
+void select_loop_get_timeout_stats(struct select_loop *loop,
+				   struct select_timeout_stats *stats);
+
+/**
+ * select_loop_post - Call a function from an event loop
+ * @loop: Loop that should call the function
+ * @handler: Callback function
+ * @select_data: Callback context data (server_ctx)
+ * @user_data: Callback context data (uagent_ctx)
+ * Returns: 0 on success, -1 on failure
+ *
+ * Queue a callback that @loop calls from its own thread on its next
+ * iteration, waking the loop up if it is blocked. This may be called from any
+ * thread and is the way to hand work and results between loops. Callbacks
+ * posted to the same loop are called in the order they were posted.
+ */
+int select_loop_post(struct select_loop *loop, select_timeout_handler handler,
+		     void *select_data, void *user_data);
+
+/**
+ * select_loop_set_persistent - Keep a loop running without handlers
+ * @loop: Loop from select_loop_new()
+ * @persistent: 1 to keep select_loop_run() going until
+ *	select_loop_terminate() even when nothing is registered, 0 for the
+ *	default behavior of returning once the last handler is gone
+ *
+ * This is meant for worker loops that are only fed with select_loop_post().
+ */
+void select_loop_set_persistent(struct select_loop *loop, int persistent);
+
+/**
+ * select_loop_run - Run an event loop
+ * @loop: Loop from select_loop_new()
+ *
+ * Like select_run(), but for the given loop. While the loop runs, it is the
+ * current loop of the calling thread, so handlers can keep using the select_*
+ * functions without a loop argument.
+ */
+void select_loop_run(struct select_loop *loop);
+
+/**
+ * select_loop_terminate - Terminate an event loop
+ * @loop: Loop from select_loop_new()
+ *
+ * Make select_loop_run() return. Unlike the other select_loop_* functions,
+ * this may be called from any thread.
+ */
+void select_loop_terminate(struct select_loop *loop);
+
+int select_loop_terminated(struct select_loop *loop);
 
-	int terminate;
-	int reader_table_changed;
-};
 #ifdef SEC_PRODUCT_FEATURE_WLAN_CHINA_WAPI
 void * select_get_user_data(void);
 #endif
@@ -15,6 +15,7 @@
 #include <errno.h>
 
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <unistd.h>
@@ -25,25 +26,59 @@
 #include "uagent_debug.h"
 #include "common.h"
 #include "server_cmd.h"
+#include "framing.h"
+#include "codec.h"
 
 
 #define IPADDRESS   "127.0.0.1"
 #define PORT        8787
 #define MAXLINE     1024
 #define LISTENQ     5 
-static struct select_data server1_select;
+
+/*
+ * Commands are pipelined: up to MAX_INFLIGHT commands may be outstanding on a
+ * connection. Each command gets the next request ID and is tracked in slot
+ * id % MAX_INFLIGHT of pending[], so a response is matched to its command in
+ * constant time whatever order the agent answers in.
+ */
+#define MAX_INFLIGHT 64
+
+struct pending_cmd {
+	u32 id; /* 0 if the slot is free */
+	enum server_cmd cmd;
+	struct os_reltime sent;
+};
+
+struct server1_client {
+	struct frame_conn *conn;
+	u32 next_id;
+	unsigned int inflight;
+	struct pending_cmd pending[MAX_INFLIGHT];
+};
+
+/* Commands pushed without waiting for replies when the agent checks in */
+static const enum server_cmd burst_cmds[] = { STATUS, LOG, STATUS };
+
+static struct server1_client *clients[FD_SETSIZE];
+
+/*
+ * Encoded commands, shared by all connections: each command is encoded once
+ * and every agent it goes to gets a view of the same data, see cmd_msg()
+ */
+static struct uagentbuf *cmd_msgs[LOG + 1];
 
 static int socket_bind(const char* ip,int port);
 static void do_select(int listenfd);
 static void handle_connection(int *connfds,int num,fd_set *prset,fd_set *pallset);
+static void handle_frame(struct frame_conn *conn, const u8 *data, size_t len,
+			 void *ctx);
+static struct server1_client * client_init(int connfd);
 
 
 int main(int argc,char *argv[])
 {	
 	
 	int  listenfd,connfd,sockfd;
-	//os_memset(&server1_select, 0, sizeof(server1_select));
-	//dl_list_init(&server1_select.timeout);
 	//select_register_timeout(5,0,demon_server1_timeout,NULL,NULL);
 	struct sockaddr_in cliaddr;
       socklen_t cliaddrlen;
@@ -131,6 +166,13 @@ static void do_select(int listenfd)
                 exit(1);
             }
             
+            clients[i] = client_init(connfd);
+            if (clients[i] == NULL)
+            {
+                close(connfd);
+                clientfds[i] = -1;
+                continue;
+            }
             FD_SET(connfd,&allset);
             
             maxfd = (connfd > maxfd ? connfd : maxfd);
@@ -144,16 +186,130 @@ static void do_select(int listenfd)
     }
 }
 
+static struct server1_client * client_init(int connfd)
+{
+	struct server1_client *client;
+
+	client = os_zalloc(sizeof(*client));
+	if (client == NULL)
+		return NULL;
+	client->conn = frame_conn_init(connfd, handle_frame, client);
+	if (client->conn == NULL) {
+		os_free(client);
+		return NULL;
+	}
+	client->next_id = 1;
+	return client;
+}
+
+static void client_deinit(struct server1_client *client)
+{
+	frame_conn_deinit(client->conn);
+	os_free(client);
+}
+
+static struct uagentbuf * cmd_msg(enum server_cmd cmd)
+{
+	struct server_msg msg;
+
+	if ((unsigned int) cmd >= ARRAY_SIZE(cmd_msgs))
+		return NULL;
+	if (cmd_msgs[cmd] == NULL) {
+		memset(&msg, 0, sizeof(msg));
+		msg.srv_cmd = cmd;
+		cmd_msgs[cmd] = uagentbuf_share(codec_encode_cmd(&msg));
+		if (cmd_msgs[cmd] == NULL)
+			return NULL;
+	}
+	return uagentbuf_clone(cmd_msgs[cmd]);
+}
+
+static int send_cmd(struct server1_client *client, enum server_cmd cmd)
+{
+	struct uagentbuf *buf;
+	struct pending_cmd *p;
+	u32 id = client->next_id;
+	int res;
+
+	p = &client->pending[id % MAX_INFLIGHT];
+	if (p->id)
+		return -1; /* too many commands in flight */
+	buf = cmd_msg(cmd);
+	if (buf == NULL)
+		return -1;
+	res = frame_send_ctrl(client->conn->sock, 0, id, uagentbuf_head(buf),
+			      uagentbuf_len(buf));
+	uagentbuf_free(buf);
+	if (res < 0)
+		return -1;
+	p->id = id;
+	p->cmd = cmd;
+	os_get_reltime(&p->sent);
+	client->inflight++;
+	if (++client->next_id == 0)
+		client->next_id = 1;
+	return 0;
+}
+
+/* Called for each complete frame received from an agent */
+static void handle_frame(struct frame_conn *conn, const u8 *data, size_t len,
+			 void *ctx)
+{
+	struct server1_client *client = ctx;
+	struct pending_cmd *p;
+	struct os_reltime now, rtt;
+	struct resp_data resp;
+	struct status_data status;
+	const u8 *cpu_stats;
+	size_t cpu_stats_len;
+	unsigned int i;
+	u8 flags;
+	u32 id;
+
+	if (frame_parse_ctrl(&data, &len, &flags, &id) < 0) {
+		printf("invalid control header\n");
+		return;
+	}
+	if (flags & FRAME_CTRL_FLAG_NOTIFY) {
+		printf("read msg is:\n ");
+		write(STDOUT_FILENO,data,len);
+		for (i = 0; i < ARRAY_SIZE(burst_cmds); i++)
+			send_cmd(client, burst_cmds[i]);
+		printf("%u commands in flight\n", client->inflight);
+		return;
+	}
+	if (!(flags & FRAME_CTRL_FLAG_RESPONSE))
+		return;
+
+	p = &client->pending[id % MAX_INFLIGHT];
+	if (p->id != id) {
+		printf("response to unknown request id %u\n", id);
+		return;
+	}
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &p->sent, &rtt);
+	printf("response id %u cmd %d after %ld.%06ld s, %u bytes\n", id,
+	       p->cmd, (long) rtt.sec, (long) rtt.usec, (unsigned int) len);
+	if (codec_decode_resp(data, len, &resp, &status, &cpu_stats,
+			      &cpu_stats_len) < 0) {
+		printf("invalid response\n");
+	} else {
+		printf("  srv_cmd %d result %d\n", resp.srv_cmd, resp.result);
+		if (resp.srv_cmd == STATUS)
+			printf("  wifi collect %d ibeacon %d net type %d "
+			       "cpu %d mem %lu cpu stats %u bytes\n",
+			       status.wifi_collect_module,
+			       status.ibeacon_status, status.net_type,
+			       status.cpu_usage, status.mem_usage,
+			       (unsigned int) cpu_stats_len);
+	}
+	p->id = 0;
+	client->inflight--;
+}
+
 static void handle_connection(int *connfds,int num,fd_set *prset,fd_set *pallset)
 {
-    int i,n;
-    char buf[MAXLINE];
-    memset(buf,0,MAXLINE);
-	struct server_msg server1_msg;
-	server1_msg.srv_cmd = STATUS;
-	char buf_cmd[MAXLINE];
-	memset(buf_cmd, 0 ,MAXLINE);
-	//memcpy(buf_cmd, &server1_msg,sizeof(struct server_msg));
+    int i;
     for (i = 0;i <= num;i++)
     {
         if (connfds[i] < 0)
@@ -161,23 +317,15 @@ static void handle_connection(int *connfds,int num,fd_set *prset,fd_set *pallset
         
         if (FD_ISSET(connfds[i],prset))
         {
-           
-            n = read(connfds[i],buf,MAXLINE);
-            if (n == 0)
+            if (frame_conn_receive(clients[i]->conn) < 0)
             {
                 close(connfds[i]);
                 FD_CLR(connfds[i],pallset);
+                client_deinit(clients[i]);
+                clients[i] = NULL;
                 connfds[i] = -1;
                 continue;
             }
-            printf("read msg is:\n ");
-            write(STDOUT_FILENO,buf,n);
-            //write(connfds[i],buf,n);
-			memset(buf,0,MAXLINE);
-			memcpy(buf_cmd, &server1_msg,sizeof(struct server_msg));
-			write(connfds[i],buf_cmd,sizeof(struct server_msg));
-			memset(buf_cmd,0,MAXLINE);
-			
         }
     }
 }
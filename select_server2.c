@@ -15,42 +15,110 @@
 #include <errno.h>
 
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include "select.h"
 #include "uagent.h"
 #include "os.h"
 #include "uagent_debug.h"
 #include "common.h"
 #include "server_cmd.h"
+#include "framing.h"
+#include "codec.h"
+#include "upload.h"
 
 #define IPADDRESS   "127.0.0.2"
 #define PORT        8787
 #define MAXLINE     1024
-#define LISTENQ     5 
-void uagent_hexdump(int level, const char *title, const u8 *buf, size_t len);
+#define LISTENQ     128
+
+/*
+ * Collector server: every worker thread runs its own select loop with its own
+ * listening socket bound to the same address with SO_REUSEPORT, so the kernel
+ * spreads incoming agent connections over the threads and each connection is
+ * only ever handled by the thread that accepted it.
+ */
+struct collector_thread {
+	pthread_t thread;
+	int id;
+	int listenfd;
+	unsigned long clients;
+	unsigned long signals;
+};
 
 static int socket_bind(const char* ip,int port);
-static void do_select(int listenfd);
-static void handle_connection(int *connfds,int num,fd_set *prset,fd_set *pallset);
+static void *collector_thread_run(void *arg);
+static void collector_accept(int listenfd, void *server_ctx, void *thread_ctx);
+static void handle_connection(int connfd, void *server_ctx, void *thread_ctx);
+static void handle_frame(struct frame_conn *conn, const u8 *data, size_t len,
+			 void *thread_ctx);
+
+static void usage(void)
+{
+	printf("usage: select_server2 [-n <threads>]\n"
+	       "  -n = number of event loop threads (default: one per CPU)\n");
+}
 
 int main(int argc,char *argv[])
-{	
-	
-	int  listenfd,connfd,sockfd;
-	struct sockaddr_in cliaddr;
-      socklen_t cliaddrlen;
-      listenfd = socket_bind(IPADDRESS,PORT);
-      listen(listenfd,LISTENQ);
-      do_select(listenfd);
-      return 0;
+{
+	struct collector_thread *threads;
+	int num_threads = 0;
+	int c, i;
+
+	for (;;) {
+		c = getopt(argc, argv, "n:");
+		if (c < 0)
+			break;
+		switch (c) {
+		case 'n':
+			num_threads = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads <= 0)
+		num_threads = 1;
+
+	threads = os_calloc(num_threads, sizeof(*threads));
+	if (threads == NULL)
+		return -1;
+
+	/* Bind all sockets up front so that a bind error is fatal at startup */
+	for (i = 0; i < num_threads; i++) {
+		threads[i].id = i;
+		threads[i].listenfd = socket_bind(IPADDRESS,PORT);
+		if (listen(threads[i].listenfd, LISTENQ) < 0) {
+			perror("listen error: ");
+			exit(1);
+		}
+	}
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i].thread, NULL,
+				   collector_thread_run, &threads[i]) != 0) {
+			perror("pthread_create error: ");
+			exit(1);
+		}
+	}
+	uagent_printf(MSG_INFO, "collector: %d event loop threads on %s:%d",
+		      num_threads, IPADDRESS, PORT);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	os_free(threads);
+	return 0;
 }
 
 static int socket_bind(const char* ip,int port)
 {
     int  listenfd;
+    int  on = 1;
     struct sockaddr_in servaddr;
     listenfd = socket(AF_INET,SOCK_STREAM,0);
     if (listenfd == -1)
@@ -58,6 +126,11 @@ static int socket_bind(const char* ip,int port)
         perror("socket error:");
         exit(1);
     }
+    if (setsockopt(listenfd,SOL_SOCKET,SO_REUSEPORT,&on,sizeof(on)) == -1)
+    {
+        perror("setsockopt SO_REUSEPORT error: ");
+        exit(1);
+    }
     bzero(&servaddr,sizeof(servaddr));
     servaddr.sin_family = AF_INET;
     inet_pton(AF_INET,ip,&servaddr.sin_addr);
@@ -70,101 +143,110 @@ static int socket_bind(const char* ip,int port)
     return listenfd;
 }
 
-static void do_select(int listenfd)
+static void *collector_thread_run(void *arg)
 {
-    int  connfd,sockfd;
-    struct sockaddr_in cliaddr;
-    socklen_t cliaddrlen;
-    fd_set  rset,allset;
-    int maxfd,maxi;
-    int i;
-    int clientfds[FD_SETSIZE];  
-    int nready;
-    for (i = 0;i < FD_SETSIZE;i++)
-        clientfds[i] = -1;
-    maxi = -1;
-    FD_ZERO(&allset);
-	
-    FD_SET(listenfd,&allset);
-    maxfd = listenfd;
-
-    for ( ; ; )
+	struct collector_thread *thr = arg;
+
+	/*
+	 * The listen socket stays in the SO_REUSEPORT group until it is
+	 * closed, and the kernel would keep handing connections to it.
+	 */
+	if (select_init() < 0) {
+		uagent_printf(MSG_ERROR, "collector[%d]: select init failed",
+			      thr->id);
+		close(thr->listenfd);
+		return NULL;
+	}
+	if (select_register_read_sock(thr->listenfd, collector_accept, NULL,
+				      thr) < 0) {
+		uagent_printf(MSG_ERROR, "collector[%d]: cannot register "
+			      "listen socket", thr->id);
+		select_destroy();
+		close(thr->listenfd);
+		return NULL;
+	}
+	select_run();
+	select_destroy();
+	return NULL;
+}
+
+static void collector_accept(int listenfd, void *server_ctx, void *thread_ctx)
+{
+	struct collector_thread *thr = thread_ctx;
+	struct sockaddr_in cliaddr;
+	socklen_t cliaddrlen = sizeof(cliaddr);
+	struct frame_conn *conn;
+	int connfd;
+
+	connfd = accept(listenfd,(struct sockaddr*)&cliaddr,&cliaddrlen);
+	if (connfd == -1) {
+		if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+			perror("accept error:");
+		return;
+	}
+	fprintf(stdout,"collector[%d]: accept a new client: %s:%d\n", thr->id,
+		inet_ntoa(cliaddr.sin_addr),cliaddr.sin_port);
+	conn = frame_conn_init(connfd, handle_frame, thr);
+	if (conn == NULL ||
+	    select_register_read_sock(connfd, handle_connection, conn,
+				      thr) < 0) {
+		fprintf(stderr,"collector[%d]: cannot register client.\n",
+			thr->id);
+		frame_conn_deinit(conn);
+		close(connfd);
+		return;
+	}
+	thr->clients++;
+}
+
+static void handle_connection(int connfd, void *server_ctx, void *thread_ctx)
+{
+    struct collector_thread *thr = thread_ctx;
+    struct frame_conn *conn = server_ctx;
+
+    if (frame_conn_receive(conn) < 0)
     {
-        rset = allset;
-
-        nready = select(maxfd+1,&rset,NULL,NULL,NULL);
-        if (nready == -1)
-        {
-            perror("select error:");
-            exit(1);
-        }
-
-        if (FD_ISSET(listenfd,&rset))
-        {
-            cliaddrlen = sizeof(cliaddr);
-
-            if ((connfd = accept(listenfd,(struct sockaddr*)&cliaddr,&cliaddrlen)) == -1)
-            {
-                if (errno == EINTR)
-                    continue;
-                else
-                {
-                   perror("accept error:");
-                   exit(1);
-                }
-            }
-            fprintf(stdout,"accept a new client: %s:%d\n", inet_ntoa(cliaddr.sin_addr),cliaddr.sin_port);
-
-            for (i = 0;i <FD_SETSIZE;i++)
-            {
-                if (clientfds[i] < 0)
-                {
-                    clientfds[i] = connfd;
-                    break;
-                }
-            }
-            if (i == FD_SETSIZE)
-            {
-                fprintf(stderr,"too many clients.\n");
-                exit(1);
-            }
-            FD_SET(connfd,&allset);
-
-            maxfd = (connfd > maxfd ? connfd : maxfd);
-			
-            maxi = (i > maxi ? i : maxi);
-            if (--nready <= 0)
-                continue;
-        }
-        handle_connection(clientfds,maxi,&rset,&allset);
+        select_unregister_read_sock(connfd);
+        frame_conn_deinit(conn);
+        close(connfd);
+        thr->clients--;
     }
 }
 
-static void handle_connection(int *connfds,int num,fd_set *prset,fd_set *pallset)
+static void handle_signal(void *thread_ctx, const struct wifi_signal_data *rec)
 {
-    int i,n;
-    char buf[MAXLINE];
-    memset(buf,0,MAXLINE);
-    for (i = 0;i <= num;i++)
+    struct collector_thread *thr = thread_ctx;
+
+    thr->signals++;
+}
+
+static void handle_frame(struct frame_conn *conn, const u8 *data, size_t len,
+			 void *thread_ctx)
+{
+    struct collector_thread *thr = thread_ctx;
+    struct status_data status;
+    struct codec_msg msg;
+    int n;
+
+    if (codec_parse(data, len, &msg) == 0 && msg.type == CODEC_MSG_SIGNALS)
+    {
+        n = upload_parse_batch(data, len, handle_signal, thr);
+        if (n < 0)
+            uagent_printf_ratelimited(MSG_WARNING, "collector[%d]: invalid "
+                                      "signal batch", thr->id);
+        else
+            uagent_printf_ratelimited(MSG_INFO, "collector[%d]: batch of %d "
+                                      "signals, %lu in total", thr->id, n,
+                                      thr->signals);
+        return;
+    }
+    if (codec_decode_status(data, len, &status) < 0)
     {
-        if (connfds[i] < 0)
-            continue;
-        if (FD_ISSET(connfds[i],prset))
-        {
-
-            n = read(connfds[i],buf,MAXLINE);
-            if (n == 0)
-            {
-                close(connfds[i]);
-                FD_CLR(connfds[i],pallset);
-                connfds[i] = -1;
-                continue;
-            }
-            printf("read msg is: \n");
-			uagent_hexdump(MSG_ERROR,"AZHE",buf,n);
-			//uagent_hexdump(MSG_ERROR,"AZHE",recvline,n);
-            //write(STDOUT_FILENO,buf,n);
-            //write(connfds[i],buf,n);
-        }
+        printf("collector[%d]: invalid status report\n", thr->id);
+        return;
     }
+    printf("collector[%d]: wifi collect %d ibeacon %d net type %d "
+           "cpu %d mem %lu\n", thr->id, status.wifi_collect_module,
+           status.ibeacon_status, status.net_type, status.cpu_usage,
+           status.mem_usage);
 }
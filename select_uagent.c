@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <errno.h> 
+#include <signal.h>
 #include "select.h"
 #include "uagent.h"
 #include "os.h"
@@ -57,7 +58,7 @@ int main(int argc,char *argv[])
 	
 	for (;;) {
 		c = getopt(argc, argv,
-			   "p:BIEW");
+			   "b:c:f:p:s:S:aABIEW");
 		if (c < 0)
 			break;
 		switch (c) {
@@ -65,6 +66,12 @@ int main(int argc,char *argv[])
 			uagent_debug_level = MSG_INFO;
 			uagent_printf(MSG_WARNING, "Uagent debug level is MSG_INFO !\n");
 			break;
+		case 'a':
+			params.uagent_debug_async = 1;
+			break;
+		case 'A':
+			params.uagent_debug_async = 2;
+			break;
 		case 'B':
 			params.daemonize++;
 			break;
@@ -76,6 +83,21 @@ int main(int argc,char *argv[])
 			uagent_debug_level = MSG_WARNING;
 			uagent_printf(MSG_WARNING, "Uagent debug level is MSG_WARNING !\n");
 			break;
+		case 'b':
+			params.upload_batch = atoi(optarg);
+			break;
+		case 'c':
+			params.cpu_window_ms = atoi(optarg);
+			break;
+		case 'f':
+			params.upload_flush_ms = atoi(optarg);
+			break;
+		case 's':
+			params.spool_path = optarg;
+			break;
+		case 'S':
+			params.spool_size = atoi(optarg) * 1024;
+			break;
 		case 'p':
 			params.uagent_debug_file_path = optarg;
 			uagent_printf(MSG_WARNING, "Uagent debug file path is %s.\n", optarg);
@@ -85,39 +107,38 @@ int main(int argc,char *argv[])
 		}
 	}	
 	
+	if (params.uagent_debug_async &&
+	    uagent_debug_async_start(0, params.uagent_debug_async == 2) < 0)
+		uagent_printf(MSG_ERROR, "Cannot start the log writer thread\n");
 	uagent_printf(MSG_INFO, "This is INFO msg.\n");
 	uagent_printf(MSG_WARNING, "This is WARNING msg.\n");
 	uagent_printf(MSG_ERROR, "This is ERROR msg.\n");
-	int error1;
-	int error2;
+	/*
+	 * A server going away must not kill the agent: writes to its socket
+	 * must fail with EPIPE instead, which sendq_write() reports through
+	 * sendq_fail(). The blocking frame_send*() calls rely on this too.
+	 */
+	signal(SIGPIPE, SIG_IGN);
 	select_init();
+	if (uagent_worker_init() < 0)
+		uagent_printf(MSG_WARNING, "No worker thread, device status is "
+			      "collected in the main loop\n");
+	uagent_sysmon_start(params.cpu_window_ms);
 	select_register_timeout(5,0,demon_learn_timeout,NULL,NULL);
 	struct sockaddr_in  servaddr1, servaddr2;
-	sockfd1 = socket(AF_INET,SOCK_STREAM,0);
-	sockfd2 = socket(AF_INET,SOCK_STREAM,0);
 	servaddr1 = client_bind_address(IPADDRESS1, SERV_PORT1);
 	servaddr2 = client_bind_address(IPADDRESS2, SERV_PORT2);
-	error1 = connect(sockfd1,(struct sockaddr*)&servaddr1,sizeof(servaddr1));
-	if (0 != error1)
-		{
-			uagent_printf(MSG_ERROR,"The connect error is %d\n",error1);
-			uagent_printf(MSG_ERROR,"errno=%d\n",errno); 
-			char * mesg = strerror(errno);
-			uagent_printf("Mesg:%s\n",mesg); 
-			return 0;
-		}
-	error2 = connect(sockfd2,(struct sockaddr*)&servaddr2,sizeof(servaddr2));
-	if (0 != error2)
+	//select_register_read_sock(STDIN_FILENO,stdin_fileno_receive,NULL,NULL);
+	/* Signals are spooled until the data channel is connected */
+	if (uagent_upload_init(params.upload_batch, params.upload_flush_ms,
+			       params.spool_path, params.spool_size) < 0)
+		uagent_printf(MSG_ERROR, "Cannot set up the signal upload\n");
+	/* The servers are connected, and reconnected, from the select loop */
+	if (uagent_connect_servers(&servaddr1, &servaddr2) < 0)
 		{
-			uagent_printf(MSG_ERROR,"The connect error is %d\n",error1);
-			uagent_printf(MSG_ERROR,"errno=%d\n",errno); 
-			char * mesg = strerror(errno);
-			uagent_printf("Mesg:%s\n",mesg); 
+			uagent_printf(MSG_ERROR, "Cannot set up the server connections\n");
 			return 0;
 		}
-	//select_register_read_sock(STDIN_FILENO,stdin_fileno_receive,NULL,NULL);
-	select_register_read_sock(sockfd1,sockfd_receive,NULL,NULL);
-	select_register_read_sock(sockfd2,sockfd_receive,NULL,NULL);
 	select_run();
       return 0;
 }
@@ -0,0 +1,264 @@
+/*
+ * Per-connection output queues
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "list.h"
+#include "select.h"
+#include "uagent_debug.h"
+#include "sendq.h"
+
+struct sendq_chunk {
+	struct dl_list list;
+	struct uagentbuf *buf; /* unsent part, consumed as it is written */
+};
+
+struct sendq {
+	int sock;
+	struct dl_list chunks; /* struct sendq_chunk, oldest first */
+	size_t len; /* bytes queued */
+	size_t high_water;
+	int writing; /* write handler registered */
+	int full; /* reached the high water mark, not drained yet */
+	int failed;
+	sendq_cb drained;
+	sendq_cb error;
+	void *ctx;
+	struct select_timeout error_timer; /* reports a failure from the loop */
+};
+
+
+static void sendq_clear(struct sendq *q)
+{
+	struct sendq_chunk *c, *n;
+
+	dl_list_for_each_safe(c, n, &q->chunks, struct sendq_chunk, list) {
+		dl_list_del(&c->list);
+		uagentbuf_free(c->buf);
+		os_free(c);
+	}
+	q->len = 0;
+}
+
+
+static void sendq_error_timeout(void *server_ctx, void *uagent_ctx)
+{
+	struct sendq *q = server_ctx;
+
+	if (q->error)
+		q->error(q, q->ctx);
+}
+
+
+struct sendq * sendq_init(int sock, size_t high_water, sendq_cb drained,
+			  sendq_cb error, void *ctx)
+{
+	struct sendq *q;
+
+	q = os_zalloc(sizeof(*q));
+	if (q == NULL)
+		return NULL;
+	q->sock = sock;
+	dl_list_init(&q->chunks);
+	q->high_water = high_water ? high_water : SENDQ_HIGH_WATER;
+	q->drained = drained;
+	q->error = error;
+	q->ctx = ctx;
+	select_timeout_init(&q->error_timer, sendq_error_timeout, q, NULL);
+	return q;
+}
+
+
+void sendq_deinit(struct sendq *q)
+{
+	if (q == NULL)
+		return;
+	if (q->writing)
+		select_unregister_sock(q->sock, EVENT_TYPE_WRITE);
+	select_timeout_disarm(&q->error_timer);
+	sendq_clear(q);
+	os_free(q);
+}
+
+
+static void sendq_fail(struct sendq *q)
+{
+	uagent_printf(MSG_ERROR, "sendq: writev(%d): %s", q->sock,
+		      strerror(errno));
+	if (q->writing) {
+		select_unregister_sock(q->sock, EVENT_TYPE_WRITE);
+		q->writing = 0;
+	}
+	sendq_clear(q);
+	q->failed = 1;
+	select_timeout_arm(&q->error_timer, 0, 0);
+}
+
+
+/* Write as much as the socket takes, returns -1 on a write error */
+static int sendq_write(struct sendq *q)
+{
+	struct iovec iov[SENDQ_MAX_IOV];
+	struct sendq_chunk *c;
+	ssize_t res;
+	size_t len;
+	int n;
+
+	while (!dl_list_empty(&q->chunks)) {
+		n = 0;
+		dl_list_for_each(c, &q->chunks, struct sendq_chunk, list) {
+			if (n == SENDQ_MAX_IOV)
+				break;
+			iov[n].iov_base = (void *) uagentbuf_head(c->buf);
+			iov[n].iov_len = uagentbuf_len(c->buf);
+			n++;
+		}
+		res = writev(q->sock, iov, n);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		q->len -= res;
+		while (res > 0) {
+			c = dl_list_first(&q->chunks, struct sendq_chunk, list);
+			len = uagentbuf_len(c->buf);
+			if ((size_t) res < len) {
+				uagentbuf_consume(c->buf, res);
+				break;
+			}
+			res -= len;
+			dl_list_del(&c->list);
+			uagentbuf_free(c->buf);
+			os_free(c);
+		}
+	}
+	return 0;
+}
+
+
+static void sendq_writable(int sock, void *server_ctx, void *uagent_ctx)
+{
+	struct sendq *q = server_ctx;
+
+	if (sendq_write(q) < 0) {
+		sendq_fail(q);
+		return;
+	}
+	if (dl_list_empty(&q->chunks)) {
+		select_unregister_sock(q->sock, EVENT_TYPE_WRITE);
+		q->writing = 0;
+	}
+	if (q->full && q->len <= q->high_water / 2) {
+		q->full = 0;
+		if (q->drained)
+			q->drained(q, q->ctx);
+	}
+}
+
+
+/* Add a chunk to the tail of the queue, takes ownership of buf */
+static int sendq_enqueue(struct sendq *q, struct uagentbuf *buf)
+{
+	struct sendq_chunk *c;
+
+	if (uagentbuf_len(buf) == 0) {
+		uagentbuf_free(buf);
+		return 0;
+	}
+	c = os_zalloc(sizeof(*c));
+	if (c == NULL) {
+		uagentbuf_free(buf);
+		return -1;
+	}
+	c->buf = buf;
+	dl_list_add_tail(&q->chunks, &c->list);
+	q->len += uagentbuf_len(buf);
+	return 0;
+}
+
+
+/* Start writing newly queued data */
+static int sendq_kick(struct sendq *q)
+{
+	/* With the write handler registered, the data goes out from there */
+	if (q->writing)
+		goto out;
+	if (sendq_write(q) < 0) {
+		sendq_fail(q);
+		return -1;
+	}
+	if (!dl_list_empty(&q->chunks)) {
+		if (select_register_sock(q->sock, EVENT_TYPE_WRITE,
+					 sendq_writable, q, NULL) < 0) {
+			sendq_fail(q);
+			return -1;
+		}
+		q->writing = 1;
+	}
+out:
+	if (q->len >= q->high_water)
+		q->full = 1;
+	return 0;
+}
+
+
+int sendq_push(struct sendq *q, struct uagentbuf *buf)
+{
+	if (q->failed) {
+		uagentbuf_free(buf);
+		return -1;
+	}
+	if (sendq_enqueue(q, buf) < 0)
+		return -1;
+	return sendq_kick(q);
+}
+
+
+int sendq_push_chain(struct sendq *q, struct uagentbuf_chain *chain)
+{
+	unsigned int i;
+	int res = 0;
+
+	if (q->failed) {
+		uagentbuf_chain_clear(chain);
+		return -1;
+	}
+	/*
+	 * All segments are queued before the first write, so that they go out
+	 * with one writev(). A message with a segment missing would corrupt
+	 * the stream, so the connection is failed if one cannot be queued.
+	 */
+	for (i = 0; i < chain->num; i++) {
+		if (res == 0)
+			res = sendq_enqueue(q, chain->seg[i]);
+		else
+			uagentbuf_free(chain->seg[i]);
+	}
+	chain->num = 0;
+	if (res < 0) {
+		sendq_fail(q);
+		return -1;
+	}
+	return sendq_kick(q);
+}
+
+
+size_t sendq_len(const struct sendq *q)
+{
+	return q->len;
+}
+
+
+int sendq_full(const struct sendq *q)
+{
+	return q->failed || q->len >= q->high_water;
+}
@@ -0,0 +1,99 @@
+/*
+ * Per-connection output queues
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines the output side of a non-blocking connection. Messages
+ * are queued as uagentbuf chunks and written with writev() as far as the
+ * socket takes them; the rest is flushed from a write handler that is only
+ * registered with the select loop while the queue is not empty. A slow peer
+ * thus never blocks the loop. The queued length is compared against a high
+ * water mark so that producers can back off instead of queueing without
+ * bound.
+ */
+
+#ifndef SENDQ_H
+#define SENDQ_H
+
+#include "uagentbuf.h"
+
+struct sendq;
+
+/* Default high water mark for sendq_init() */
+#define SENDQ_HIGH_WATER (256 * 1024)
+/* Chunks written per writev() call */
+#define SENDQ_MAX_IOV 64
+
+/**
+ * sendq_cb - Callback for output queue events
+ * @q: Queue from sendq_init()
+ * @ctx: Callback context data from sendq_init()
+ */
+typedef void (*sendq_cb)(struct sendq *q, void *ctx);
+
+/**
+ * sendq_init - Set up the output queue of a connection
+ * @sock: Connected socket in non-blocking mode
+ * @high_water: High water mark in bytes or 0 for %SENDQ_HIGH_WATER
+ * @drained: Callback for when a queue that reached the high water mark has
+ *	drained to half of it, or %NULL
+ * @error: Callback for a write error, or %NULL
+ * @ctx: Callback context data
+ * Returns: Pointer to the queue or %NULL on failure
+ *
+ * The error callback is called from the select loop, never from within
+ * sendq_push(), so it may free the queue. The queue uses the select loop of
+ * the calling thread and must only be used from that thread.
+ */
+struct sendq * sendq_init(int sock, size_t high_water, sendq_cb drained,
+			  sendq_cb error, void *ctx);
+
+/**
+ * sendq_deinit - Free an output queue and the data still queued
+ * @q: Queue from sendq_init() or %NULL
+ *
+ * The socket is not closed.
+ */
+void sendq_deinit(struct sendq *q);
+
+/**
+ * sendq_push - Queue data for sending
+ * @q: Queue from sendq_init()
+ * @buf: Data to send, owned by the queue from now on even on failure
+ * Returns: 0 on success, -1 if the connection has failed
+ *
+ * The data is always queued, even beyond the high water mark; producers that
+ * can hold back are expected to check sendq_full() first.
+ */
+int sendq_push(struct sendq *q, struct uagentbuf *buf);
+
+/**
+ * sendq_push_chain - Queue a message assembled from several buffers
+ * @q: Queue from sendq_init()
+ * @chain: Message to send; the segments are owned by the queue from now on
+ *	even on failure and the chain is left empty
+ * Returns: 0 on success, -1 if the connection has failed
+ *
+ * The segments are queued as they are, without copying them together, and
+ * written out with writev().
+ */
+int sendq_push_chain(struct sendq *q, struct uagentbuf_chain *chain);
+
+/**
+ * sendq_len - Get the number of bytes waiting to be sent
+ * @q: Queue from sendq_init()
+ * Returns: Queued bytes
+ */
+size_t sendq_len(const struct sendq *q);
+
+/**
+ * sendq_full - Check the high water mark
+ * @q: Queue from sendq_init()
+ * Returns: 1 if the queue is at or above the high water mark or has failed,
+ * 0 otherwise
+ */
+int sendq_full(const struct sendq *q);
+
+#endif /* SENDQ_H */
@@ -14,6 +14,8 @@
 （4）在线导出log
 ********************************************************************************/
 
+#include "sysmon.h" /* SYSMON_MAX_CPUS */
+
 /**********************************************************************************/
 /********************************Macro Definition**********************************/
 /**********************************************************************************/
@@ -105,14 +107,22 @@ struct server_msg
 	char					msg[256];                    /* 如果是update命令，则应该是新版本的路径，否则为0，不必解析 */
 };
 
-typedef struct PACKED         //����һ��cpu occupy�Ľṹ��
-{
-char name[20];      //����һ��char���͵�������name��20��Ԫ��
-unsigned int user; //����һ���޷��ŵ�int���͵�user
-unsigned int nice; //����һ���޷��ŵ�int���͵�nice
-unsigned int system;//����һ���޷��ŵ�int���͵�system
-unsigned int idle; //����һ���޷��ŵ�int���͵�idle
-}CPU_OCCUPY;
+/*
+ * CPU statistics carried as the value of CODEC_TAG_CPU_STATS in the STATUS
+ * response:
+ *
+ *   u8 version (CPU_STATS_VERSION)
+ *   u8 count: number of entries, the aggregate of all cores followed by
+ *	core 0, 1, ...
+ *   count * entry: user, nice, system, iowait, irq, softirq, steal as
+ *	big endian u16 shares of the sampling window in units of 0.01%;
+ *	idle is the remainder up to 10000
+ */
+#define CPU_STATS_VERSION	1
+#define CPU_STATS_HDR_LEN	2
+#define CPU_STATS_ENTRY_LEN	14
+#define CPU_STATS_MAX_LEN	(CPU_STATS_HDR_LEN + \
+				 (SYSMON_MAX_CPUS + 1) * CPU_STATS_ENTRY_LEN)
 
 struct status_data dev_status_handle();
 struct resp_data handle_server_msg(struct server_msg server_messege, 
@@ -13,7 +13,7 @@
 #include "uagent_debug.h"
 #include "common.h"
 #include "server_cmd.h"
-#include <sys/sysinfo.h>
+#include "sysmon.h"
 static int get_ibeacon_status()
 {
 	return 0;
@@ -28,80 +28,30 @@ static int get_net_type()
 {
 	return 0;
 }
-static int cal_cpuoccupy (CPU_OCCUPY *o, CPU_OCCUPY *n) 
-{   
-    unsigned long od, nd;    
-    unsigned long id, sd;
-    int cpu_use = 0;   
-    
-    od = (unsigned long) (o->user + o->nice + o->system +o->idle);
-    nd = (unsigned long) (n->user + n->nice + n->system +n->idle);
-      
-    id = (unsigned long) (n->user - o->user);    
-    sd = (unsigned long) (n->system - o->system);
-    if((nd-od) != 0)
-    	cpu_use = (int)((sd+id)*10000)/(nd-od); 
-    else 
-		{	cpu_use = 0;
-			uagent_printf(MSG_ERROR,"The old is equal to new.\n");
-    	}
-    return cpu_use;
-}
-
-static void  get_cpuoccupy_sample (CPU_OCCUPY *cpust) 
-{   
-    FILE *fd;         
-    int n;            
-    char buff[256]; 
-    CPU_OCCUPY *cpu_occupy;
-    cpu_occupy=cpust;
-                                                                                                               
-    fd = fopen ("/proc/stat", "r"); 
-    fgets (buff, sizeof(buff), fd);
-    
-    sscanf (buff, "%s %u %u %u %u", cpu_occupy->name, &cpu_occupy->user, &cpu_occupy->nice,&cpu_occupy->system, &cpu_occupy->idle);
-    
-    fclose(fd);     
-}
-static int get_cpuoccupy_status()
-{
-	CPU_OCCUPY cpu_stat1;
-    CPU_OCCUPY cpu_stat2;
-	int cpu;
-	get_cpuoccupy_sample((CPU_OCCUPY *)&cpu_stat1);
-	sleep(2);
-	get_cpuoccupy_sample((CPU_OCCUPY *)&cpu_stat2);
-	cpu = cal_cpuoccupy ((CPU_OCCUPY *)&cpu_stat1, (CPU_OCCUPY *)&cpu_stat2);
-	return cpu;
-}
-
 static unsigned long get_memoccupy_status()
 {
-	struct sysinfo s_info;
-	int error;
-	unsigned long mem;
-	float memoccupy;
-	error = sysinfo(&s_info);
-	if (0 != error)
-		{ 
-			uagent_printf(MSG_ERROR,"Get mem info code error=%d\n",error);
+	struct sysmon_mem_sample mem;
+	struct sysmon_load_sample load;
+	unsigned long mem_usage;
+
+	if (sysmon_read_mem(&mem) < 0)
+		{
+			uagent_printf(MSG_ERROR,"Get mem info error\n");
 			return -1;
 		}
-	uagent_printf(MSG_INFO,"Uptime = %ds\nLoad: 1 min%d / 5 min %d / 15 min %d\n"
-           "RAM: total %d / free %d /shared%d\n"
-           "Memory in buffers = %d\nSwap:total%d/free%d\n"
-           "Number of processes = %d\n",
-           s_info.uptime, s_info.loads[0],
-           s_info.loads[1], s_info.loads[2],
-           s_info.totalram, s_info.freeram,
-           s_info.sharedram, s_info.bufferram,
-           s_info.totalswap, s_info.freeswap,
-          s_info.procs );
-	memoccupy = (float)(s_info.totalram - s_info.freeram)/(float)s_info.totalram ;
-	uagent_printf(MSG_INFO,"The mem occupy is %f\n",memoccupy);
-	mem = memoccupy * 10000;
-    return mem;
-
+	if (sysmon_read_load(&load) == 0)
+		uagent_printf(MSG_INFO,"Load: 1 min %u.%02u / 5 min %u.%02u / "
+			"15 min %u.%02u\nNumber of processes = %u\n",
+			load.load[0] / 100, load.load[0] % 100,
+			load.load[1] / 100, load.load[1] % 100,
+			load.load[2] / 100, load.load[2] % 100, load.threads);
+	uagent_printf(MSG_INFO,"RAM: total %llu kB / free %llu kB / available "
+		"%llu kB\nMemory in buffers = %llu kB, cached = %llu kB\n",
+		mem.total, mem.free, mem.available, mem.buffers, mem.cached);
+	/* Same measure as sysinfo() totalram - freeram used before */
+	mem_usage = (mem.total - mem.free) * 10000 / mem.total;
+	uagent_printf(MSG_INFO,"The mem occupy is %lu\n",mem_usage);
+	return mem_usage;
 }
 void dev_update()
 {
@@ -117,10 +67,27 @@ void dev_restart()
 	return;
 }
 
+/*
+ * A peer can send STATUS at will, so only the aggregate is logged, rate
+ * limited; the per-core values go out in the STATUS reply.
+ */
+static void log_cpu_breakdown()
+{
+	struct sysmon_cpu_usage u;
+
+	if (sysmon_cpu_breakdown(SYSMON_CPU_ALL, &u) < 0)
+		return;
+	uagent_printf_ratelimited(MSG_INFO,"cpu: idle %u user %u nice %u "
+		"system %u iowait %u irq %u softirq %u steal %u\n",
+		u.idle, u.user, u.nice, u.system, u.iowait, u.irq,
+		u.softirq, u.steal);
+}
+
 struct status_data dev_status_handle()
 {
 	struct status_data dev_status;
-	dev_status.cpu_usage = get_cpuoccupy_status();
+	dev_status.cpu_usage = sysmon_cpu_usage();
+	log_cpu_breakdown();
 	dev_status.ibeacon_status = get_ibeacon_status();
 	dev_status.wifi_collect_module = get_wifi_module_status();
 	dev_status.net_type = get_net_type();
@@ -147,7 +114,8 @@ struct resp_data handle_server_msg(struct server_msg server_messege,
 			dev_restart();
 			break;
 		case 2:
-			*status = dev_status_handle();
+			if (status)
+				*status = dev_status_handle();
 			break;
 		case 3:	
 			dev_log();
@@ -156,6 +124,7 @@ struct resp_data handle_server_msg(struct server_msg server_messege,
 			uagent_printf(MSG_ERROR,"No such server command!");			
 	 }
 	 resp_server.srv_cmd = server_messege.srv_cmd;
+	 resp_server.result = 0;
 	return resp_server;
 }
 
@@ -0,0 +1,370 @@
+/*
+ * Disk spool for data channel messages
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "uagent_debug.h"
+#include "spool.h"
+
+#define SPOOL_ALIGN_LEN(len) (((len) + SPOOL_ALIGN - 1) & ~(SPOOL_ALIGN - 1))
+#define SPOOL_REC_LEN(msg_len) SPOOL_ALIGN_LEN(SPOOL_REC_HDR_LEN + (msg_len))
+
+/*
+ * The live records are the ring [head, tail) of the data area, oldest first,
+ * with sequence numbers head_seq .. head_seq + count - 1.
+ */
+struct spool {
+	u8 *map;
+	size_t map_len;
+	u8 *data; /* data area within map */
+	size_t size; /* of the data area */
+	size_t head;
+	size_t tail;
+	unsigned int count;
+	u64 head_seq;
+	unsigned long evicted;
+	size_t page_mask; /* msync() ranges start on a page boundary */
+};
+
+/* Record found while recovering the spool */
+struct spool_found {
+	u64 seq;
+	size_t off;
+	size_t len; /* including header and padding */
+};
+
+
+static u32 spool_crc_table[256];
+
+static u32 spool_crc32(u32 crc, const u8 *buf, size_t len)
+{
+	u32 c;
+	int i, j;
+
+	if (spool_crc_table[1] == 0) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			spool_crc_table[i] = c;
+		}
+	}
+	crc = ~crc;
+	while (len--)
+		crc = spool_crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+
+/* CRC of a record, covering the length, sequence number and message */
+static u32 spool_rec_crc(const u8 *rec, size_t msg_len)
+{
+	u32 crc;
+
+	crc = spool_crc32(0, rec + 4, 12);
+	return spool_crc32(crc, rec + SPOOL_REC_HDR_LEN, msg_len);
+}
+
+
+/* Schedule writeback of the @len bytes at @pos in the mapping */
+static void spool_sync(struct spool *sp, const u8 *pos, size_t len)
+{
+	size_t off = pos - sp->map;
+	size_t start = off & ~sp->page_mask;
+
+	if (msync(sp->map + start, off + len - start, MS_ASYNC) < 0)
+		uagent_printf(MSG_ERROR, "spool: msync: %s", strerror(errno));
+}
+
+
+static void spool_save_head_seq(struct spool *sp)
+{
+	uagent_PUT_LE64(sp->map + 16, sp->head_seq);
+	spool_sync(sp, sp->map + 16, 8);
+}
+
+
+/* Validate the record at @off, returns its message length or -1 */
+static long spool_check_rec(struct spool *sp, size_t off)
+{
+	const u8 *rec = sp->data + off;
+	u32 len;
+
+	if (off + SPOOL_REC_HDR_LEN > sp->size ||
+	    uagent_GET_LE32(rec) != SPOOL_REC_MAGIC)
+		return -1;
+	len = uagent_GET_LE32(rec + 4);
+	if (len > sp->size - off - SPOOL_REC_HDR_LEN ||
+	    uagent_GET_LE32(rec + 16) != spool_rec_crc(rec, len))
+		return -1;
+	return len;
+}
+
+
+/* Offset at which the writer puts a record of @len bytes after @end */
+static size_t spool_next_off(struct spool *sp, size_t end, size_t len)
+{
+	return end + len > sp->size ? 0 : end;
+}
+
+
+static int spool_found_cmp(const void *a, const void *b)
+{
+	const struct spool_found *fa = a, *fb = b;
+
+	if (fa->seq < fb->seq)
+		return -1;
+	return fa->seq > fb->seq;
+}
+
+
+/*
+ * Find the live records after a restart: the intact records that have not
+ * been consumed, ending with the newest one, whose sequence numbers and
+ * positions follow each other the way the writer lays them out. Anything else
+ * is a leftover of an evicted record or a record torn by a crash.
+ */
+static int spool_recover(struct spool *sp)
+{
+	struct spool_found *found = NULL, *n;
+	size_t num = 0, alloc = 0, off = 0, i;
+	long len;
+	u64 seq;
+
+	while (off + SPOOL_REC_HDR_LEN <= sp->size) {
+		len = spool_check_rec(sp, off);
+		if (len < 0) {
+			off += SPOOL_ALIGN;
+			continue;
+		}
+		seq = uagent_GET_LE64(sp->data + off + 8);
+		if (seq >= sp->head_seq) {
+			if (num == alloc) {
+				alloc = alloc ? 2 * alloc : 64;
+				n = os_realloc_array(found, alloc, sizeof(*n));
+				if (n == NULL) {
+					os_free(found);
+					return -1;
+				}
+				found = n;
+			}
+			found[num].seq = seq;
+			found[num].off = off;
+			found[num].len = SPOOL_REC_LEN(len);
+			num++;
+		}
+		off += SPOOL_REC_LEN(len);
+	}
+	if (num == 0) {
+		os_free(found);
+		return 0;
+	}
+
+	qsort(found, num, sizeof(*found), spool_found_cmp);
+	i = num - 1;
+	while (i > 0 && found[i - 1].seq + 1 == found[i].seq &&
+	       spool_next_off(sp, found[i - 1].off + found[i - 1].len,
+			      found[i].len) == found[i].off)
+		i--;
+	sp->head = found[i].off;
+	sp->tail = found[num - 1].off + found[num - 1].len;
+	sp->count = num - i;
+	sp->head_seq = found[i].seq;
+	spool_save_head_seq(sp);
+	os_free(found);
+	return 0;
+}
+
+
+struct spool * spool_open(const char *path, size_t size)
+{
+	struct spool *sp;
+	struct stat st;
+	int fd;
+
+	if (size == 0)
+		size = SPOOL_DEFAULT_SIZE;
+	size = SPOOL_ALIGN_LEN(size);
+
+	sp = os_zalloc(sizeof(*sp));
+	if (sp == NULL)
+		return NULL;
+	sp->size = size;
+	sp->map_len = SPOOL_FILE_HDR_LEN + size;
+	sp->page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		uagent_printf(MSG_ERROR, "spool: %s: %s", path,
+			      strerror(errno));
+		goto fail;
+	}
+	if ((size_t) st.st_size != sp->map_len) {
+		/* Start over with a zeroed file */
+		if (ftruncate(fd, 0) < 0 ||
+		    ftruncate(fd, sp->map_len) < 0) {
+			uagent_printf(MSG_ERROR, "spool: ftruncate(%s): %s",
+				      path, strerror(errno));
+			goto fail;
+		}
+	}
+	sp->map = mmap(NULL, sp->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fd, 0);
+	if (sp->map == MAP_FAILED) {
+		uagent_printf(MSG_ERROR, "spool: mmap(%s): %s", path,
+			      strerror(errno));
+		sp->map = NULL;
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+	sp->data = sp->map + SPOOL_FILE_HDR_LEN;
+
+	if (uagent_GET_LE32(sp->map) != SPOOL_FILE_MAGIC ||
+	    uagent_GET_LE32(sp->map + 4) != SPOOL_VERSION ||
+	    uagent_GET_LE64(sp->map + 8) != size) {
+		os_memset(sp->map, 0, sp->map_len);
+		uagent_PUT_LE32(sp->map + 4, SPOOL_VERSION);
+		uagent_PUT_LE64(sp->map + 8, size);
+		sp->head_seq = 1;
+		spool_save_head_seq(sp);
+		uagent_PUT_LE32(sp->map, SPOOL_FILE_MAGIC);
+	} else {
+		sp->head_seq = uagent_GET_LE64(sp->map + 16);
+		if (spool_recover(sp) < 0)
+			goto fail;
+		if (sp->count)
+			uagent_printf(MSG_INFO, "spool: %u messages recovered "
+				      "from %s", sp->count, path);
+	}
+	return sp;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	if (sp->map)
+		munmap(sp->map, sp->map_len);
+	os_free(sp);
+	return NULL;
+}
+
+
+void spool_close(struct spool *sp)
+{
+	if (sp == NULL)
+		return;
+	msync(sp->map, sp->map_len, MS_SYNC);
+	munmap(sp->map, sp->map_len);
+	os_free(sp);
+}
+
+
+/* Drop the record at head */
+static void spool_advance(struct spool *sp)
+{
+	u32 len = uagent_GET_LE32(sp->data + sp->head + 4);
+
+	sp->head += SPOOL_REC_LEN(len);
+	sp->count--;
+	sp->head_seq++;
+	spool_save_head_seq(sp);
+	if (sp->count == 0) {
+		sp->head = sp->tail = 0;
+	} else if (sp->head + SPOOL_REC_HDR_LEN > sp->size ||
+		   uagent_GET_LE32(sp->data + sp->head) == SPOOL_PAD_MAGIC) {
+		sp->head = 0;
+	}
+}
+
+
+/* Evict the oldest records until @len bytes are free at tail */
+static void spool_make_room(struct spool *sp, size_t len)
+{
+	for (;;) {
+		if (sp->count == 0) {
+			sp->head = sp->tail = 0;
+			return;
+		}
+		if (sp->head < sp->tail) {
+			/* Free space is [tail, size) and [0, head) */
+			if (sp->tail + len <= sp->size)
+				return;
+			if (sp->tail + SPOOL_REC_HDR_LEN <= sp->size) {
+				uagent_PUT_LE32(sp->data + sp->tail,
+						SPOOL_PAD_MAGIC);
+				spool_sync(sp, sp->data + sp->tail, 4);
+			}
+			sp->tail = 0;
+			continue;
+		}
+		/* Free space is [tail, head) */
+		if (sp->head - sp->tail >= len)
+			return;
+		spool_advance(sp);
+		sp->evicted++;
+	}
+}
+
+
+int spool_append(struct spool *sp, const void *data, size_t len)
+{
+	size_t rec_len = SPOOL_REC_LEN(len);
+	u8 *rec;
+
+	if (rec_len > sp->size)
+		return -1;
+	spool_make_room(sp, rec_len);
+	rec = sp->data + sp->tail;
+	uagent_PUT_LE32(rec, 0);
+	os_memcpy(rec + SPOOL_REC_HDR_LEN, data, len);
+	uagent_PUT_LE32(rec + 4, len);
+	uagent_PUT_LE64(rec + 8, sp->head_seq + sp->count);
+	uagent_PUT_LE32(rec + 16, spool_rec_crc(rec, len));
+	uagent_PUT_LE32(rec + 20, 0);
+	/* The record is only valid once the magic is in place */
+	uagent_PUT_LE32(rec, SPOOL_REC_MAGIC);
+	spool_sync(sp, rec, rec_len);
+	sp->tail += rec_len;
+	sp->count++;
+	return 0;
+}
+
+
+const u8 * spool_peek(struct spool *sp, size_t *len)
+{
+	if (sp->count == 0)
+		return NULL;
+	*len = uagent_GET_LE32(sp->data + sp->head + 4);
+	return sp->data + sp->head + SPOOL_REC_HDR_LEN;
+}
+
+
+void spool_consume(struct spool *sp)
+{
+	if (sp->count)
+		spool_advance(sp);
+}
+
+
+unsigned int spool_count(const struct spool *sp)
+{
+	return sp->count;
+}
+
+
+unsigned long spool_evicted(struct spool *sp)
+{
+	unsigned long evicted = sp->evicted;
+
+	sp->evicted = 0;
+	return evicted;
+}
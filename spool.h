@@ -0,0 +1,118 @@
+/*
+ * Disk spool for data channel messages
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines a bounded FIFO of messages kept in a memory mapped file,
+ * used to hold encoded signal batches while the data channel is down so that
+ * they can be sent in order once it is back. The spool survives a restart of
+ * the agent; when it is full, the oldest messages are dropped.
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+struct spool;
+
+/*
+ * File layout, all integers little endian:
+ *
+ * File header (SPOOL_FILE_HDR_LEN):
+ *   u32 magic (SPOOL_FILE_MAGIC)
+ *   u32 version (SPOOL_VERSION)
+ *   u64 size of the data area
+ *   u64 sequence number of the oldest live record; records with a lower
+ *	number have been consumed or evicted
+ *   u64 reserved
+ *
+ * Data area, used as a ring of records aligned to SPOOL_ALIGN:
+ *   u32 magic (SPOOL_REC_MAGIC, or SPOOL_PAD_MAGIC where the writer wrapped
+ *	around to the start of the data area)
+ *   u32 message length
+ *   u64 sequence number
+ *   u32 CRC-32 of the length, the sequence number and the message
+ *   u32 reserved
+ *   message
+ *
+ * The magic is written last, and a record only counts if its CRC matches, so
+ * a record torn by a crash or power loss is ignored when the spool is opened.
+ * Records and header updates are scheduled for writeback with msync(MS_ASYNC)
+ * as they are written. An agent crash loses no records, but a power loss
+ * loses those the kernel has not written back yet; on Linux that is up to its
+ * dirty page writeback interval.
+ * A record also wraps around to the start of the data area when there is no
+ * room for the record header before the end.
+ */
+#define SPOOL_FILE_MAGIC 0x50534155 /* "UASP" */
+#define SPOOL_REC_MAGIC 0x52505355 /* "USPR" */
+#define SPOOL_PAD_MAGIC 0x44505355 /* "USPD" */
+#define SPOOL_VERSION 1
+#define SPOOL_FILE_HDR_LEN 32
+#define SPOOL_REC_HDR_LEN 24
+#define SPOOL_ALIGN 8
+
+/* Default size of the data area */
+#define SPOOL_DEFAULT_SIZE (4 * 1024 * 1024)
+
+/**
+ * spool_open - Open or create a spool file
+ * @path: Path of the spool file
+ * @size: Size of the data area or 0 for %SPOOL_DEFAULT_SIZE
+ * Returns: Pointer to the spool or %NULL on failure
+ *
+ * Records left by a previous run are recovered. A file with another size or
+ * version is discarded and reinitialized.
+ */
+struct spool * spool_open(const char *path, size_t size);
+
+/**
+ * spool_close - Close a spool
+ * @sp: Spool from spool_open() or %NULL
+ *
+ * Queued records stay in the file for the next spool_open().
+ */
+void spool_close(struct spool *sp);
+
+/**
+ * spool_append - Append a message to a spool
+ * @sp: Spool from spool_open()
+ * @data: Message
+ * @len: Length of the message
+ * Returns: 0 on success, -1 if the message does not fit in the spool at all
+ *
+ * The oldest records are evicted as needed to make room.
+ */
+int spool_append(struct spool *sp, const void *data, size_t len);
+
+/**
+ * spool_peek - Get the oldest message in a spool
+ * @sp: Spool from spool_open()
+ * @len: Buffer for the length of the message
+ * Returns: Pointer to the message in the file mapping, valid until the spool
+ * is next modified, or %NULL if the spool is empty
+ */
+const u8 * spool_peek(struct spool *sp, size_t *len);
+
+/**
+ * spool_consume - Remove the oldest message from a spool
+ * @sp: Spool from spool_open()
+ */
+void spool_consume(struct spool *sp);
+
+/**
+ * spool_count - Get the number of messages in a spool
+ * @sp: Spool from spool_open()
+ * Returns: Number of queued messages
+ */
+unsigned int spool_count(const struct spool *sp);
+
+/**
+ * spool_evicted - Get and reset the number of evicted messages
+ * @sp: Spool from spool_open()
+ * Returns: Number of messages dropped to make room since the last call
+ */
+unsigned long spool_evicted(struct spool *sp);
+
+#endif /* SPOOL_H */
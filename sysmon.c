@@ -0,0 +1,502 @@
+/*
+ * System resource monitor
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+#include <fcntl.h>
+
+#include "common.h"
+#include "select.h"
+#include "server_cmd.h"
+#include "sysmon.h"
+
+
+/*
+ * CPU snapshots are kept in a ring of cpu_ring entries, each holding the
+ * aggregate counters followed by those of every core. The usage reported is
+ * the delta between the newest snapshot and the one a window length before
+ * it, so every tick refreshes the values while they still average over the
+ * whole window.
+ */
+struct sysmon_data {
+	struct sysmon_cpu_sample *cpu; /* cpu_ring * (num_cpus + 1) samples */
+	unsigned int num_cpus;
+	unsigned int cpu_ring; /* snapshots allocated, window span + 1 */
+	unsigned int cpu_next; /* ring position of the next snapshot */
+	unsigned int cpu_count; /* number of valid snapshots in the ring */
+	unsigned int cpu_span; /* ticks per window */
+	struct sysmon_cpu_usage *usage; /* num_cpus + 1, aggregate first */
+	int cpu_usage;
+	int running;
+	struct select_timeout cpu_timer; /* pending while running */
+};
+
+static struct sysmon_data sysmon;
+
+
+/*
+ * A /proc file that stays open between samples. The kernel regenerates the
+ * contents on every read from offset 0, so pread() gives a fresh snapshot
+ * without the open/close and stdio buffering of fopen().
+ */
+struct sysmon_proc {
+	const char *path;
+	int fd;
+};
+
+static struct sysmon_proc sysmon_proc_stat = { "/proc/stat", -1 };
+static struct sysmon_proc sysmon_proc_meminfo = { "/proc/meminfo", -1 };
+static struct sysmon_proc sysmon_proc_loadavg = { "/proc/loadavg", -1 };
+
+/*
+ * Only the head of each file is parsed: the cpu lines of /proc/stat and the
+ * first few fields of /proc/meminfo are well within this.
+ */
+static char sysmon_buf[4096];
+
+
+static void sysmon_proc_close(struct sysmon_proc *proc)
+{
+	if (proc->fd >= 0) {
+		close(proc->fd);
+		proc->fd = -1;
+	}
+}
+
+
+/* Returns the number of bytes read into sysmon_buf (NUL terminated) or -1 */
+static int sysmon_proc_read(struct sysmon_proc *proc)
+{
+	ssize_t res;
+	int retry;
+
+	for (retry = 0; retry < 2; retry++) {
+		if (proc->fd < 0) {
+			proc->fd = open(proc->path, O_RDONLY);
+			if (proc->fd < 0) {
+				uagent_printf(MSG_ERROR, "sysmon: open %s: %s",
+					      proc->path, strerror(errno));
+				return -1;
+			}
+			fcntl(proc->fd, F_SETFD, FD_CLOEXEC);
+		}
+		do {
+			res = pread(proc->fd, sysmon_buf,
+				    sizeof(sysmon_buf) - 1, 0);
+		} while (res < 0 && errno == EINTR);
+		if (res >= 0) {
+			sysmon_buf[res] = '\0';
+			return res;
+		}
+		/* Reopen once in case the descriptor went stale */
+		sysmon_proc_close(proc);
+	}
+	uagent_printf(MSG_ERROR, "sysmon: read %s: %s", proc->path,
+		      strerror(errno));
+	return -1;
+}
+
+
+static const char * sysmon_skip_blank(const char *pos)
+{
+	while (*pos == ' ' || *pos == '\t')
+		pos++;
+	return pos;
+}
+
+
+/*
+ * Parse an unsigned decimal number after optional blanks. Returns a pointer
+ * past the last digit or %NULL if there is no number at pos.
+ */
+static const char * sysmon_scan_ull(const char *pos, unsigned long long *val)
+{
+	unsigned long long v = 0;
+
+	pos = sysmon_skip_blank(pos);
+	if (*pos < '0' || *pos > '9')
+		return NULL;
+	while (*pos >= '0' && *pos <= '9')
+		v = v * 10 + (*pos++ - '0');
+	*val = v;
+	return pos;
+}
+
+
+static const char * sysmon_scan_uint(const char *pos, unsigned int *val)
+{
+	unsigned long long v;
+
+	pos = sysmon_scan_ull(pos, &v);
+	if (pos)
+		*val = v;
+	return pos;
+}
+
+
+/* Parse a "12.34" style number into 1234 */
+static const char * sysmon_scan_centi(const char *pos, unsigned int *val)
+{
+	unsigned int v, i;
+
+	pos = sysmon_scan_uint(pos, &v);
+	if (pos == NULL)
+		return NULL;
+	v *= 100;
+	if (*pos == '.') {
+		pos++;
+		for (i = 10; i > 0 && *pos >= '0' && *pos <= '9'; i /= 10)
+			v += (*pos++ - '0') * i;
+		while (*pos >= '0' && *pos <= '9')
+			pos++;
+	}
+	*val = v;
+	return pos;
+}
+
+/* Fields after idle are missing on old kernels and are left at zero */
+static const char * sysmon_scan_cpu_line(const char *pos,
+					 struct sysmon_cpu_sample *sample)
+{
+	unsigned long long *fields[] = {
+		&sample->user, &sample->nice, &sample->system, &sample->idle,
+		&sample->iowait, &sample->irq, &sample->softirq, &sample->steal
+	};
+	const char *next;
+	unsigned int i;
+
+	os_memset(sample, 0, sizeof(*sample));
+	for (i = 0; i < ARRAY_SIZE(fields); i++) {
+		next = sysmon_scan_ull(pos, fields[i]);
+		if (next == NULL)
+			return i < 4 ? NULL : pos;
+		pos = next;
+	}
+	return pos;
+}
+
+
+int sysmon_read_cpus(struct sysmon_cpu_sample *samples, unsigned int max)
+{
+	const char *pos = sysmon_buf;
+	unsigned int cpu, num = 1;
+
+	if (max == 0 || sysmon_proc_read(&sysmon_proc_stat) < 0)
+		return -1;
+	if (os_strncmp(pos, "cpu ", 4) != 0 ||
+	    sysmon_scan_cpu_line(pos + 4, &samples[0]) == NULL)
+		return -1;
+
+	/* Per-core lines follow the aggregate one; offline cores are absent */
+	for (;;) {
+		pos = os_strchr(pos, '\n');
+		if (pos == NULL || os_strncmp(++pos, "cpu", 3) != 0)
+			break;
+		pos = sysmon_scan_uint(pos + 3, &cpu);
+		if (pos == NULL)
+			break;
+		if (cpu + 1 >= max)
+			continue;
+		if (sysmon_scan_cpu_line(pos, &samples[cpu + 1]) == NULL)
+			return -1;
+		if (cpu + 2 > num)
+			num = cpu + 2;
+	}
+	return num;
+}
+
+
+int sysmon_read_cpu(struct sysmon_cpu_sample *sample)
+{
+	return sysmon_read_cpus(sample, 1) < 0 ? -1 : 0;
+}
+
+
+static const struct {
+	const char *name;
+	size_t len;
+	size_t offset;
+} sysmon_meminfo_fields[] = {
+	{ "MemTotal:", 9, offsetof(struct sysmon_mem_sample, total) },
+	{ "MemFree:", 8, offsetof(struct sysmon_mem_sample, free) },
+	{ "MemAvailable:", 13, offsetof(struct sysmon_mem_sample, available) },
+	{ "Buffers:", 8, offsetof(struct sysmon_mem_sample, buffers) },
+	{ "Cached:", 7, offsetof(struct sysmon_mem_sample, cached) },
+};
+
+
+int sysmon_read_mem(struct sysmon_mem_sample *mem)
+{
+	const char *pos = sysmon_buf;
+	unsigned int i, found = 0;
+
+	if (sysmon_proc_read(&sysmon_proc_meminfo) < 0)
+		return -1;
+	os_memset(mem, 0, sizeof(*mem));
+	while (*pos && found < ARRAY_SIZE(sysmon_meminfo_fields)) {
+		for (i = 0; i < ARRAY_SIZE(sysmon_meminfo_fields); i++) {
+			if (os_strncmp(pos, sysmon_meminfo_fields[i].name,
+				       sysmon_meminfo_fields[i].len) != 0)
+				continue;
+			sysmon_scan_ull(pos + sysmon_meminfo_fields[i].len,
+					(unsigned long long *)
+					((u8 *) mem +
+					 sysmon_meminfo_fields[i].offset));
+			found++;
+			break;
+		}
+		pos = os_strchr(pos, '\n');
+		if (pos == NULL)
+			break;
+		pos++;
+	}
+	return mem->total ? 0 : -1;
+}
+
+
+int sysmon_read_load(struct sysmon_load_sample *load)
+{
+	const char *pos = sysmon_buf;
+
+	if (sysmon_proc_read(&sysmon_proc_loadavg) < 0)
+		return -1;
+	if ((pos = sysmon_scan_centi(pos, &load->load[0])) == NULL ||
+	    (pos = sysmon_scan_centi(pos, &load->load[1])) == NULL ||
+	    (pos = sysmon_scan_centi(pos, &load->load[2])) == NULL ||
+	    (pos = sysmon_scan_uint(pos, &load->running)) == NULL ||
+	    *pos++ != '/' ||
+	    (pos = sysmon_scan_uint(pos, &load->threads)) == NULL)
+		return -1;
+	return 0;
+}
+
+
+/* Counters such as iowait may go backwards, treat that as no time spent */
+#define SYSMON_DELTA(o, n, f) ((n)->f > (o)->f ? (n)->f - (o)->f : 0)
+
+static void sysmon_cpu_calc(const struct sysmon_cpu_sample *o,
+			    const struct sysmon_cpu_sample *n,
+			    struct sysmon_cpu_usage *usage, int *busy)
+{
+	unsigned long long d[8], total = 0;
+	unsigned int i, sum = 0;
+
+	d[0] = SYSMON_DELTA(o, n, user);
+	d[1] = SYSMON_DELTA(o, n, nice);
+	d[2] = SYSMON_DELTA(o, n, system);
+	d[3] = SYSMON_DELTA(o, n, iowait);
+	d[4] = SYSMON_DELTA(o, n, irq);
+	d[5] = SYSMON_DELTA(o, n, softirq);
+	d[6] = SYSMON_DELTA(o, n, steal);
+	d[7] = SYSMON_DELTA(o, n, idle);
+	for (i = 0; i < ARRAY_SIZE(d); i++)
+		total += d[i];
+
+	os_memset(usage, 0, sizeof(*usage));
+	if (busy)
+		*busy = 0;
+	if (total == 0) {
+		usage->idle = 10000;
+		return;
+	}
+	usage->user = d[0] * 10000 / total;
+	usage->nice = d[1] * 10000 / total;
+	usage->system = d[2] * 10000 / total;
+	usage->iowait = d[3] * 10000 / total;
+	usage->irq = d[4] * 10000 / total;
+	usage->softirq = d[5] * 10000 / total;
+	usage->steal = d[6] * 10000 / total;
+	sum = usage->user + usage->nice + usage->system + usage->iowait +
+		usage->irq + usage->softirq + usage->steal;
+	/* Rounding leftovers go to idle so that the shares add up to 100% */
+	usage->idle = sum < 10000 ? 10000 - sum : 0;
+	if (busy)
+		*busy = (d[0] + d[2]) * 10000 / total;
+}
+
+
+static struct sysmon_cpu_sample * sysmon_cpu_snapshot(unsigned int pos)
+{
+	return &sysmon.cpu[pos * (sysmon.num_cpus + 1)];
+}
+
+
+static void sysmon_cpu_update(void)
+{
+	const struct sysmon_cpu_sample *newest, *oldest;
+	unsigned int span, pos, i;
+
+	if (sysmon.cpu_count < 2)
+		return;
+	span = sysmon.cpu_span;
+	if (span > sysmon.cpu_count - 1)
+		span = sysmon.cpu_count - 1;
+	pos = (sysmon.cpu_next + sysmon.cpu_ring - 1) % sysmon.cpu_ring;
+	newest = sysmon_cpu_snapshot(pos);
+	oldest = sysmon_cpu_snapshot((pos + sysmon.cpu_ring - span) %
+				     sysmon.cpu_ring);
+	sysmon_cpu_calc(&oldest[0], &newest[0], &sysmon.usage[0],
+			&sysmon.cpu_usage);
+	for (i = 1; i <= sysmon.num_cpus; i++)
+		sysmon_cpu_calc(&oldest[i], &newest[i], &sysmon.usage[i],
+				NULL);
+}
+
+
+static void sysmon_cpu_sample(void)
+{
+	struct sysmon_cpu_sample *snap;
+
+	snap = sysmon_cpu_snapshot(sysmon.cpu_next);
+	/* Cores that went offline are absent and read as idle */
+	os_memset(snap, 0, (sysmon.num_cpus + 1) * sizeof(*snap));
+	if (sysmon_read_cpus(snap, sysmon.num_cpus + 1) < 0) {
+		uagent_printf(MSG_ERROR, "sysmon: cannot read /proc/stat");
+		return;
+	}
+	sysmon.cpu_next = (sysmon.cpu_next + 1) % sysmon.cpu_ring;
+	if (sysmon.cpu_count < sysmon.cpu_ring)
+		sysmon.cpu_count++;
+	sysmon_cpu_update();
+}
+
+
+static void sysmon_cpu_timeout(void *select_ctx, void *user_ctx)
+{
+	sysmon_cpu_sample();
+	/* Fired timers leave a free heap slot, so only the clock can fail */
+	if (select_timeout_arm(&sysmon.cpu_timer, 0,
+			       SYSMON_CPU_TICK_MS * 1000) < 0)
+		uagent_printf(MSG_ERROR, "sysmon: cannot schedule CPU sampling");
+}
+
+
+void sysmon_set_window(unsigned int window_ms)
+{
+	struct sysmon_cpu_sample *cpu;
+	unsigned int span;
+
+	if (window_ms == 0)
+		window_ms = SYSMON_CPU_WINDOW_MS;
+	span = (window_ms + SYSMON_CPU_TICK_MS - 1) / SYSMON_CPU_TICK_MS;
+	if (span > SYSMON_CPU_MAX_SAMPLES - 1)
+		span = SYSMON_CPU_MAX_SAMPLES - 1;
+	if (span == sysmon.cpu_span)
+		return;
+
+	/* The ring is resized, the current values stay until it refills */
+	cpu = os_calloc((span + 1) * (sysmon.num_cpus + 1), sizeof(*cpu));
+	if (cpu == NULL)
+		return;
+	os_free(sysmon.cpu);
+	sysmon.cpu = cpu;
+	sysmon.cpu_ring = span + 1;
+	sysmon.cpu_span = span;
+	sysmon.cpu_next = 0;
+	sysmon.cpu_count = 0;
+}
+
+
+int sysmon_init(unsigned int window_ms)
+{
+	struct sysmon_cpu_sample probe[SYSMON_MAX_CPUS + 1];
+	int num;
+
+	if (sysmon.running)
+		sysmon_deinit();
+	os_memset(&sysmon, 0, sizeof(sysmon));
+
+	num = sysmon_read_cpus(probe, ARRAY_SIZE(probe));
+	if (num < 0)
+		return -1;
+	sysmon.num_cpus = num - 1;
+	sysmon.usage = os_calloc(num, sizeof(*sysmon.usage));
+	if (sysmon.usage == NULL)
+		return -1;
+	sysmon_set_window(window_ms);
+	if (sysmon.cpu == NULL) {
+		os_free(sysmon.usage);
+		sysmon.usage = NULL;
+		return -1;
+	}
+	sysmon_cpu_sample();
+	select_timeout_init(&sysmon.cpu_timer, sysmon_cpu_timeout, NULL, NULL);
+	if (select_timeout_arm(&sysmon.cpu_timer, 0,
+			       SYSMON_CPU_TICK_MS * 1000) < 0) {
+		os_free(sysmon.cpu);
+		sysmon.cpu = NULL;
+		os_free(sysmon.usage);
+		sysmon.usage = NULL;
+		return -1;
+	}
+	sysmon.running = 1;
+	return 0;
+}
+
+
+void sysmon_deinit(void)
+{
+	select_timeout_disarm(&sysmon.cpu_timer);
+	sysmon.running = 0;
+	os_free(sysmon.cpu);
+	sysmon.cpu = NULL;
+	os_free(sysmon.usage);
+	sysmon.usage = NULL;
+	sysmon_proc_close(&sysmon_proc_stat);
+	sysmon_proc_close(&sysmon_proc_meminfo);
+	sysmon_proc_close(&sysmon_proc_loadavg);
+}
+
+
+int sysmon_cpu_usage(void)
+{
+	return sysmon.cpu_usage;
+}
+
+
+unsigned int sysmon_num_cpus(void)
+{
+	return sysmon.num_cpus;
+}
+
+
+int sysmon_cpu_breakdown(int cpu, struct sysmon_cpu_usage *usage)
+{
+	if (sysmon.usage == NULL || cpu < SYSMON_CPU_ALL ||
+	    cpu >= (int) sysmon.num_cpus)
+		return -1;
+	*usage = sysmon.usage[cpu + 1];
+	return 0;
+}
+
+
+int sysmon_cpu_stats_encode(u8 *buf, size_t len)
+{
+	const struct sysmon_cpu_usage *u;
+	unsigned int i, count;
+	u8 *pos = buf;
+
+	if (sysmon.usage == NULL)
+		return 0;
+	count = sysmon.num_cpus + 1;
+	if (len < CPU_STATS_HDR_LEN + count * CPU_STATS_ENTRY_LEN)
+		return -1;
+	*pos++ = CPU_STATS_VERSION;
+	*pos++ = count;
+	for (i = 0; i < count; i++) {
+		u = &sysmon.usage[i];
+		uagent_PUT_BE16(pos, u->user);
+		uagent_PUT_BE16(pos + 2, u->nice);
+		uagent_PUT_BE16(pos + 4, u->system);
+		uagent_PUT_BE16(pos + 6, u->iowait);
+		uagent_PUT_BE16(pos + 8, u->irq);
+		uagent_PUT_BE16(pos + 10, u->softirq);
+		uagent_PUT_BE16(pos + 12, u->steal);
+		pos += CPU_STATS_ENTRY_LEN;
+	}
+	return pos - buf;
+}
@@ -0,0 +1,197 @@
+/*
+ * System resource monitor
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines the interface for sampling the system resource usage
+ * reported in the device status. CPU usage is sampled in the background from
+ * a select timeout, so a status request is answered from the latest sample
+ * instead of blocking the event loop while measuring.
+ *
+ * The /proc files are opened once and re-read from offset 0 with pread() into
+ * a preallocated buffer, and parsed without stdio, since the agent runs on
+ * low-end routers where fopen()/sscanf() per sample is measurable.
+ */
+
+#ifndef SYSMON_H
+#define SYSMON_H
+
+/* Default length of the window the CPU usage is averaged over */
+#define SYSMON_CPU_WINDOW_MS 2000
+
+/* Interval between two /proc/stat samples */
+#define SYSMON_CPU_TICK_MS 500
+
+/* Maximum number of samples kept, this limits the window length */
+#define SYSMON_CPU_MAX_SAMPLES 64
+
+/* Maximum number of cores tracked, higher numbered cores are ignored */
+#define SYSMON_MAX_CPUS 32
+
+/* sysmon_cpu_breakdown() index for the aggregate of all cores */
+#define SYSMON_CPU_ALL -1
+
+/**
+ * struct sysmon_cpu_sample - CPU time counters from a /proc/stat cpu line
+ * @user: Time spent in user mode
+ * @nice: Time spent in user mode with low priority
+ * @system: Time spent in kernel mode
+ * @idle: Time spent idle
+ * @iowait: Time spent idle waiting for I/O
+ * @irq: Time spent servicing hardware interrupts
+ * @softirq: Time spent servicing softirqs
+ * @steal: Time stolen by the hypervisor
+ *
+ * All values are in USER_HZ ticks since boot.
+ */
+struct sysmon_cpu_sample {
+	unsigned long long user;
+	unsigned long long nice;
+	unsigned long long system;
+	unsigned long long idle;
+	unsigned long long iowait;
+	unsigned long long irq;
+	unsigned long long softirq;
+	unsigned long long steal;
+};
+
+/**
+ * struct sysmon_cpu_usage - Share of the window spent in each CPU state
+ *
+ * Each field is in units of 0.01% and all fields add up to 10000.
+ */
+struct sysmon_cpu_usage {
+	unsigned short user;
+	unsigned short nice;
+	unsigned short system;
+	unsigned short idle;
+	unsigned short iowait;
+	unsigned short irq;
+	unsigned short softirq;
+	unsigned short steal;
+};
+
+/**
+ * struct sysmon_mem_sample - Memory counters from /proc/meminfo
+ * @total: MemTotal in kB
+ * @free: MemFree in kB
+ * @available: MemAvailable in kB, 0 on kernels that do not report it
+ * @buffers: Buffers in kB
+ * @cached: Cached in kB
+ */
+struct sysmon_mem_sample {
+	unsigned long long total;
+	unsigned long long free;
+	unsigned long long available;
+	unsigned long long buffers;
+	unsigned long long cached;
+};
+
+/**
+ * struct sysmon_load_sample - Load average from /proc/loadavg
+ * @load: 1, 5 and 15 minute load averages multiplied by 100
+ * @running: Number of currently runnable tasks
+ * @threads: Number of tasks
+ */
+struct sysmon_load_sample {
+	unsigned int load[3];
+	unsigned int running;
+	unsigned int threads;
+};
+
+/**
+ * sysmon_read_cpu - Read the aggregate CPU counters
+ * @sample: Buffer for the counters
+ * Returns: 0 on success, -1 on failure
+ */
+int sysmon_read_cpu(struct sysmon_cpu_sample *sample);
+
+/**
+ * sysmon_read_cpus - Read the aggregate and per-core CPU counters
+ * @samples: Buffer for the counters, the aggregate followed by core 0, 1, ..
+ * @max: Number of entries in @samples
+ * Returns: Number of entries used (1 + highest core number + 1), or -1 on
+ * failure
+ *
+ * Entries of cores that are offline are not written.
+ */
+int sysmon_read_cpus(struct sysmon_cpu_sample *samples, unsigned int max);
+
+/**
+ * sysmon_read_mem - Read the memory counters
+ * @mem: Buffer for the counters
+ * Returns: 0 on success, -1 on failure
+ */
+int sysmon_read_mem(struct sysmon_mem_sample *mem);
+
+/**
+ * sysmon_read_load - Read the load average
+ * @load: Buffer for the load average
+ * Returns: 0 on success, -1 on failure
+ */
+int sysmon_read_load(struct sysmon_load_sample *load);
+
+/**
+ * sysmon_init - Start background CPU sampling
+ * @window_ms: Length of the window the CPU usage is averaged over in
+ *	milliseconds, or 0 for %SYSMON_CPU_WINDOW_MS
+ * Returns: 0 on success, -1 on failure
+ *
+ * Takes the first sample and registers a timeout on the select loop of the
+ * calling thread that keeps sampling every %SYSMON_CPU_TICK_MS. The other
+ * sysmon_* functions must be called from the same thread.
+ */
+int sysmon_init(unsigned int window_ms);
+
+/**
+ * sysmon_deinit - Stop background CPU sampling and close the /proc files
+ */
+void sysmon_deinit(void);
+
+/**
+ * sysmon_set_window - Change the CPU usage averaging window
+ * @window_ms: Window length in milliseconds, or 0 for %SYSMON_CPU_WINDOW_MS
+ *
+ * The window is rounded up to a multiple of %SYSMON_CPU_TICK_MS and limited
+ * by %SYSMON_CPU_MAX_SAMPLES. Until enough samples have been taken, the usage
+ * is computed over the samples available.
+ */
+void sysmon_set_window(unsigned int window_ms);
+
+/**
+ * sysmon_cpu_usage - Get the latest CPU usage
+ * Returns: User and system CPU time over the window in units of 0.01%, or 0
+ * if fewer than two samples have been taken
+ *
+ * This does not read /proc and never blocks.
+ */
+int sysmon_cpu_usage(void);
+
+/**
+ * sysmon_num_cpus - Get the number of cores tracked
+ * Returns: Number of cores, 0 if sampling has not been started
+ */
+unsigned int sysmon_num_cpus(void);
+
+/**
+ * sysmon_cpu_breakdown - Get the latest CPU usage per state
+ * @cpu: Core number or %SYSMON_CPU_ALL for the aggregate
+ * @usage: Buffer for the usage
+ * Returns: 0 on success, -1 if @cpu is not tracked
+ */
+int sysmon_cpu_breakdown(int cpu, struct sysmon_cpu_usage *usage);
+
+/**
+ * sysmon_cpu_stats_encode - Encode the CPU usage for the STATUS reply
+ * @buf: Buffer for the encoded data
+ * @len: Length of @buf
+ * Returns: Number of bytes written, 0 if sampling has not been started, or -1
+ * if @buf is too small
+ *
+ * The format is described with %CPU_STATS_VERSION in server_cmd.h.
+ */
+int sysmon_cpu_stats_encode(u8 *buf, size_t len);
+
+#endif /* SYSMON_H */
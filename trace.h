@@ -0,0 +1,18 @@
+/*
+ * Backtrace debugging
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef uagent_TRACE
+void uagent_trace_show(const char *title);
+#else /* uagent_TRACE */
+#define uagent_trace_show(title) do { } while (0)
+#endif /* uagent_TRACE */
+
+#endif /* TRACE_H */
@@ -18,82 +18,405 @@
 #include <sys/select.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include "select.h"
 #include "uagent.h"
 #include "os.h"
 #include "uagent_debug.h"
 #include "common.h"
 #include "server_cmd.h"
+#include "sysmon.h"
+#include "framing.h"
+#include "codec.h"
+#include "spool.h"
+#include "upload.h"
+#include "client.h"
+#include "sendq.h"
+
+/*
+ * Collecting the device status can block for a while, so it runs on a worker
+ * loop in its own thread. The result is posted back to the main loop, which
+ * owns the server sockets and writes the reply.
+ */
+static struct select_loop *uagent_main_loop;
+static struct select_loop *uagent_worker_loop;
+
+/*
+ * Collected signals go to the data channel through the batching pipeline, see
+ * upload.h, and to the disk spool while the data channel is down. All of this
+ * runs in the main loop.
+ */
+static struct upload *uagent_upload;
+static struct spool *uagent_spool;
+
+/*
+ * Connection to one of the servers, kept up by the client connection
+ * manager; the socket is mirrored in sockfd1 or sockfd2 while it is up. All
+ * output goes through the tx queue so that a slow server never blocks the
+ * main loop.
+ */
+struct uagent_server {
+	struct client *client;
+	struct frame_conn *rx;
+	struct sendq *tx;
+	int *sockfd;
+	int data; /* data channel, feeds the upload pipeline */
+	unsigned int gen; /* bumped for every new connection */
+};
+
+static struct uagent_server uagent_ctrl_server = {
+	NULL, NULL, NULL, &sockfd1, 0
+};
+static struct uagent_server uagent_data_server = {
+	NULL, NULL, NULL, &sockfd2, 1
+};
+
+/*
+ * A STATUS job remembers the connection by generation rather than by socket:
+ * after a reconnect the new socket usually gets the same descriptor, and the
+ * reply must not go to a connection that never sent the request.
+ */
+struct uagent_status_job {
+	struct uagent_server *srv;
+	unsigned int gen; /* connection of srv the request came from */
+	u32 req_id; /* request ID of the STATUS command */
+	int with_resp; /* reply to a STATUS command rather than a report */
+	struct resp_data resp;
+	struct status_data status;
+	u8 cpu_stats[CPU_STATS_MAX_LEN]; /* appended to the STATUS reply */
+	int cpu_stats_len;
+};
+
+static void * uagent_worker_thread(void *arg)
+{
+	select_loop_run(arg);
+	return NULL;
+}
+
+int uagent_worker_init(void)
+{
+	pthread_t thread;
+
+	uagent_main_loop = select_loop_current();
+	uagent_worker_loop = select_loop_new();
+	if (uagent_worker_loop == NULL)
+		return -1;
+	select_loop_set_persistent(uagent_worker_loop, 1);
+	if (pthread_create(&thread, NULL, uagent_worker_thread,
+			   uagent_worker_loop) != 0) {
+		select_loop_free(uagent_worker_loop);
+		uagent_worker_loop = NULL;
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+static void uagent_sysmon_init(void *server_ctx, void *uagent_ctx)
+{
+	unsigned int window_ms = (unsigned long) server_ctx;
+
+	if (sysmon_init(window_ms) < 0)
+		uagent_printf(MSG_ERROR, "Cannot start the CPU sampler\n");
+}
+
+/*
+ * The sampler runs on the loop that collects the device status so that
+ * dev_status_handle() reads the samples from the thread that takes them.
+ */
+void uagent_sysmon_start(unsigned int window_ms)
+{
+	void *ctx = (void *) (unsigned long) window_ms;
+
+	if (uagent_worker_loop &&
+	    select_loop_post(uagent_worker_loop, uagent_sysmon_init, ctx,
+			     NULL) == 0)
+		return;
+	uagent_sysmon_init(ctx, NULL);
+}
+
+/* Runs in the main loop */
+static void uagent_status_send(void *server_ctx, void *uagent_ctx)
+{
+	struct uagent_status_job *job = server_ctx;
+	struct uagentbuf *msg;
+	struct sendq *tx;
+
+	if (job->with_resp) {
+		msg = codec_encode_resp(&job->resp, &job->status,
+					job->cpu_stats, job->cpu_stats_len);
+	} else {
+		uagent_printf(MSG_ERROR,"the dev status about wifi collect module is %d,"
+			"the ibeacon status is %d, the net type is %d, the cpu_usage is %d\n",
+			job->status.wifi_collect_module,job->status.ibeacon_status,
+			job->status.net_type, job->status.cpu_usage);
+		msg = codec_encode_status(&job->status);
+	}
+	if (msg == NULL) {
+		os_free(job);
+		return;
+	}
+	tx = job->gen == job->srv->gen ? job->srv->tx : NULL;
+	if (tx == NULL) {
+		/* The connection went away while the status was collected */
+		uagentbuf_free(msg);
+		os_free(job);
+		return;
+	}
+	if (job->with_resp) {
+		uagent_hexdump_ratelimited(MSG_INFO, "AZHE",
+					   uagentbuf_head(msg),
+					   uagentbuf_len(msg));
+		frame_queue_ctrl_buf(tx, FRAME_CTRL_FLAG_RESPONSE, job->req_id,
+				     msg);
+	} else {
+		frame_queue_buf(tx, msg);
+	}
+	os_free(job);
+}
+
+static void uagent_status_fill(struct uagent_status_job *job)
+{
+	job->status = dev_status_handle();
+	if (job->with_resp) {
+		job->cpu_stats_len =
+			sysmon_cpu_stats_encode(job->cpu_stats,
+						sizeof(job->cpu_stats));
+		if (job->cpu_stats_len < 0)
+			job->cpu_stats_len = 0;
+	}
+}
+
+/* Runs in the worker loop */
+static void uagent_status_collect(void *server_ctx, void *uagent_ctx)
+{
+	struct uagent_status_job *job = server_ctx;
+
+	uagent_status_fill(job);
+	if (select_loop_post(uagent_main_loop, uagent_status_send, job,
+			     NULL) < 0)
+		os_free(job);
+}
+
+/*
+ * STATUS replies complete asynchronously, so they may overtake or be overtaken
+ * by replies to later commands; the server matches them by request ID.
+ */
+static void uagent_status_request(struct uagent_server *srv,
+				  const struct resp_data *resp, u32 req_id)
+{
+	struct uagent_status_job *job;
+
+	job = os_zalloc(sizeof(*job));
+	if (job == NULL)
+		return;
+	job->srv = srv;
+	job->gen = srv->gen;
+	job->req_id = req_id;
+	if (resp) {
+		job->with_resp = 1;
+		job->resp = *resp;
+	}
+	if (uagent_worker_loop &&
+	    select_loop_post(uagent_worker_loop, uagent_status_collect, job,
+			     NULL) == 0)
+		return;
+
+	/* No worker thread, collect in the main loop */
+	uagent_status_fill(job);
+	uagent_status_send(job, NULL);
+}
 
 void stdin_fileno_receive(int sockfd, void *server1fd, void *server2fd)
 {	
 	char    sendline[MAXLINE];
 	int n;
-	int socketfd1 = *((int *)server1fd);
-	int socketfd2 = *((int *)server2fd);
 	uagent_printf(MSG_INFO, "STDIN is received \n");
 	n = read(sockfd,sendline,MAXLINE);
-	write(socketfd1,sendline,n);
-	write(socketfd2,sendline,n);
+	if (n <= 0)
+		return;
+	/* Passed on to the control server as a notification */
+	if (uagent_ctrl_server.tx)
+		frame_queue_ctrl(uagent_ctrl_server.tx,FRAME_CTRL_FLAG_NOTIFY,0,
+			sendline,n);
 }	
 
-void sockfd_receive(int sockfd, void *server_ctx, void *uagent_ctx)
-{	
-	char   recvline[MAXLINE];
-	char   buf[MAXLINE];
-	int n,m;
+/* Called for each complete frame received from a server */
+static void server_frame_receive(struct frame_conn *conn, const u8 *data,
+				 size_t len, void *ctx)
+{
+	struct uagent_server *srv = ctx;
 	int cmd_type;
-	int rsp_len;
+	int sockfd = conn->sock;
 	struct server_msg server_rev_msg;
-	struct status_data dev_status;
-	uagent_printf(MSG_INFO, "Sockfd%d server is received \n",sockfd);
-	n = read(sockfd,recvline,MAXLINE);
-	m = sizeof(struct server_msg);
-	rsp_len = sizeof(struct resp_data);
-	uagent_printf(MSG_INFO, "Size of server_msg is %d \n",m);
-	uagent_hexdump(MSG_ERROR,"AZHE",recvline,n);
-	if (m == n )
-		{ 	
-			memcpy(&server_rev_msg,recvline,sizeof(struct server_msg));
-			cmd_type = server_rev_msg.srv_cmd;
-			uagent_printf(MSG_ERROR, "sockfd %d server is received server_cmd %d.\n",
-				sockfd,cmd_type);
-			struct resp_data resp_server;
-			resp_server = handle_server_msg( server_rev_msg, &dev_status);
-			uagent_printf(MSG_ERROR, "The response cmd is %d \n", resp_server.srv_cmd);
-			memcpy(buf,&resp_server,rsp_len);
-			if(resp_server.srv_cmd == STATUS)
-			{
-				memcpy(buf+rsp_len,&dev_status,sizeof(struct status_data));
-				rsp_len += sizeof(struct status_data);
-			}
-			uagent_hexdump(MSG_ERROR, "AZHE", buf, rsp_len);
-			write(sockfd,buf,rsp_len);
+	struct uagentbuf *rsp;
+	u8 flags;
+	u32 req_id;
+	/* A server sending a flood of commands must not flood the log */
+	uagent_hexdump_ratelimited(MSG_INFO,"AZHE",data,len);
+	if (frame_parse_ctrl(&data, &len, &flags, &req_id) < 0)
+		{
+			uagent_printf_ratelimited(MSG_ERROR, "sockfd %d invalid control header\n",
+				sockfd);
+			return;
+		}
+	if (flags & (FRAME_CTRL_FLAG_RESPONSE | FRAME_CTRL_FLAG_NOTIFY))
+		return;
+	if (codec_decode_cmd(data, len, &server_rev_msg) < 0)
+		{
+			uagent_printf_ratelimited(MSG_ERROR, "sockfd %d invalid server msg\n",
+				sockfd);
+			return;
+		}
+	cmd_type = server_rev_msg.srv_cmd;
+	uagent_printf_ratelimited(MSG_ERROR, "sockfd %d server is received server_cmd %d id %u.\n",
+		sockfd,cmd_type,req_id);
+	struct resp_data resp_server;
+	/* The status is collected by the worker, see uagent_status_request() */
+	resp_server = handle_server_msg( server_rev_msg, NULL);
+	uagent_printf_ratelimited(MSG_ERROR, "The response cmd is %d \n", resp_server.srv_cmd);
+	if(resp_server.srv_cmd == STATUS)
+	{
+		uagent_status_request(srv, &resp_server, req_id);
+		return;
+	}
+	rsp = codec_encode_resp(&resp_server, NULL, NULL, 0);
+	if (rsp == NULL)
+		return;
+	uagent_hexdump_ratelimited(MSG_INFO, "AZHE", uagentbuf_head(rsp), uagentbuf_len(rsp));
+	if (srv->tx)
+		frame_queue_ctrl_buf(srv->tx,FRAME_CTRL_FLAG_RESPONSE,
+			req_id,rsp);
+	else
+		uagentbuf_free(rsp);
+}
+
+void sockfd_receive(int sockfd, void *server_ctx, void *uagent_ctx)
+{	
+	struct frame_conn *conn = server_ctx;
+	struct uagent_server *srv = uagent_ctx;
+	uagent_printf_ratelimited(MSG_INFO, "Sockfd%d server is received \n",sockfd);
+	if (frame_conn_receive(conn) < 0)
+		{
+			uagent_printf(MSG_ERROR, "sockfd %d server closed the connection\n",
+				sockfd);
+			/* uagent_server_disconnected() cleans up, then reconnect */
+			client_lost(srv->client);
 		}
-	
-	//= sizeof(struct server_msg);
-	//write(STDOUT_FILENO,recvline,n);
 }	
 
+/* The output queue of a server went below half its high water mark */
+static void uagent_server_drained(struct sendq *q, void *ctx)
+{
+	struct uagent_server *srv = ctx;
+
+	if (srv->data && uagent_upload)
+		upload_resume(uagent_upload);
+}
+
+static void uagent_server_tx_error(struct sendq *q, void *ctx)
+{
+	struct uagent_server *srv = ctx;
+
+	client_lost(srv->client);
+}
+
+static void uagent_server_connected(struct client *cl, int sock, void *ctx)
+{
+	struct uagent_server *srv = ctx;
+
+	/* Replies still pending for the previous connection are dropped */
+	srv->gen++;
+	srv->tx = sendq_init(sock, 0, uagent_server_drained,
+			     uagent_server_tx_error, srv);
+	srv->rx = frame_conn_init(sock, server_frame_receive, srv);
+	if (srv->tx == NULL || srv->rx == NULL ||
+	    select_register_read_sock(sock, sockfd_receive, srv->rx, srv) < 0) {
+		frame_conn_deinit(srv->rx);
+		srv->rx = NULL;
+		client_lost(cl);
+		return;
+	}
+	*srv->sockfd = sock;
+	if (srv->data && uagent_upload)
+		upload_set_queue(uagent_upload, srv->tx);
+}
+
+static void uagent_server_disconnected(struct client *cl, int sock, void *ctx)
+{
+	struct uagent_server *srv = ctx;
+
+	/* Spool the signals until the data channel is back */
+	if (srv->data && uagent_upload)
+		upload_set_queue(uagent_upload, NULL);
+	if (srv->rx) {
+		select_unregister_read_sock(sock);
+		frame_conn_deinit(srv->rx);
+		srv->rx = NULL;
+	}
+	sendq_deinit(srv->tx);
+	srv->tx = NULL;
+	*srv->sockfd = -1;
+}
+
+int uagent_connect_servers(const struct sockaddr_in *ctrl_addr,
+			   const struct sockaddr_in *data_addr)
+{
+	sockfd1 = sockfd2 = -1;
+	uagent_ctrl_server.client = client_init("control", ctrl_addr,
+						uagent_server_connected,
+						uagent_server_disconnected,
+						&uagent_ctrl_server);
+	uagent_data_server.client = client_init("data", data_addr,
+						uagent_server_connected,
+						uagent_server_disconnected,
+						&uagent_data_server);
+	if (uagent_ctrl_server.client == NULL ||
+	    uagent_data_server.client == NULL)
+		return -1;
+	return 0;
+}
+
+int uagent_upload_init(unsigned int batch, unsigned int flush_ms,
+		       const char *spool_path, size_t spool_size)
+{
+	uagent_upload = upload_init(uagent_data_server.tx, batch, flush_ms, 0);
+	if (uagent_upload == NULL)
+		return -1;
+	if (spool_path) {
+		uagent_spool = spool_open(spool_path, spool_size);
+		if (uagent_spool == NULL)
+			uagent_printf(MSG_ERROR, "Cannot open the spool %s, "
+				      "signals are lost while the data channel "
+				      "is down\n", spool_path);
+		upload_set_spool(uagent_upload, uagent_spool);
+	}
+	return 0;
+}
+
+int uagent_signal_report(const struct wifi_signal_data *data)
+{
+	if (uagent_upload == NULL)
+		return -1;
+	return upload_add(uagent_upload, data);
+}
+
 void demon_learn_timeout(void *eloop_ctx, void *timeout_ctx)
 {
+	struct uagentbuf_pool_stats pool;
+
 	select_register_timeout(5,0,demon_learn_timeout,NULL,NULL);
 	uagent_printf(MSG_INFO, "Demon learn timemout is OKAY!\n");
-	write(sockfd1,"Start server cmd\n",18);
-	struct status_data dev_status;
-	char buf[MAXLINE];
-	/*dev_status.ibeacon_status = 0;
-	dev_status.wifi_collect_module = 1;
-	dev_status.net_type = 0;
-	dev_status.cpu_usage = 20;
-	dev_status.mem_usage = 30;*/
-	dev_status = dev_status_handle();
-	uagent_printf(MSG_ERROR,"the dev status about wifi collect module is %d,"
-		"the ibeacon status is %d, the net type is %d, the cpu_usage is %d\n",
-		dev_status.wifi_collect_module,dev_status.ibeacon_status,dev_status.net_type,
-		 dev_status.cpu_usage);
-	memcpy(buf,&dev_status,sizeof(struct status_data));
-	write(sockfd2,buf,sizeof(struct status_data));
+	uagentbuf_pool_get_stats(&pool);
+	uagent_printf(MSG_INFO, "uagentbuf pool: %lu hits %lu misses %lu oversize "
+		"%lu foreign, %lu buffers (%lu bytes) cached\n", pool.hits,
+		pool.misses, pool.oversize, pool.foreign, pool.cached,
+		(unsigned long) pool.cached_bytes);
+	if (uagent_ctrl_server.tx)
+		frame_queue_ctrl(uagent_ctrl_server.tx,FRAME_CTRL_FLAG_NOTIFY,0,
+			"Start server cmd\n",17);
+	if (uagent_data_server.tx)
+		uagent_status_request(&uagent_data_server, NULL, 0);
 }
 struct sockaddr_in client_bind_address( char *ipaddress, int serv_port)
 {
@@ -41,11 +41,55 @@ struct uagent_params {
 	 */
 	const char *uagent_debug_file_path;
 
+	/**
+	 * cpu_window_ms - CPU usage averaging window or 0 for the default
+	 */
+	unsigned int cpu_window_ms;
+
+	/**
+	 * upload_batch - Signal records per data channel batch or 0 for the
+	 * default
+	 */
+	unsigned int upload_batch;
+
+	/**
+	 * upload_flush_ms - Longest delay before a signal record is sent or 0
+	 * for the default
+	 */
+	unsigned int upload_flush_ms;
+
+	/**
+	 * spool_path - File for signals collected while the data channel is
+	 * down or %NULL to drop them
+	 */
+	const char *spool_path;
+
+	/**
+	 * spool_size - Size of the spool in bytes or 0 for the default
+	 */
+	size_t spool_size;
+
 	/**
 	 * wpa_debug_syslog - Enable log output through syslog
 	 */
 	int uagent_debug_syslog;
+
+	/**
+	 * uagent_debug_async - Write debug output from a separate thread: 0
+	 * for synchronous output, 1 to drop messages while the writer falls
+	 * behind, 2 to wait for it
+	 */
+	int uagent_debug_async;
 };
+int uagent_worker_init(void);
+void uagent_sysmon_start(unsigned int window_ms);
+struct sockaddr_in;
+int uagent_connect_servers(const struct sockaddr_in *ctrl_addr,
+			   const struct sockaddr_in *data_addr);
+int uagent_upload_init(unsigned int batch, unsigned int flush_ms,
+		       const char *spool_path, size_t spool_size);
+struct wifi_signal_data;
+int uagent_signal_report(const struct wifi_signal_data *data);
 void sockfd_receive(int sockfd, void *server_ctx, void *uagent_ctx);
 void stdin_fileno_receive(int sockfd, void *server1fd, void *server2fd);
 
@@ -7,6 +7,8 @@
  */
 
 #include "includes.h"
+#include <pthread.h>
+#include <sched.h>
 
 #include "common.h"
 
@@ -38,6 +40,40 @@ static FILE *out_file = NULL;
 #endif /* CONFIG_DEBUG_FILE */
 
 
+/*
+ * Asynchronous output: a bounded multi-producer ring of preformatted records,
+ * drained by a writer thread. A producer claims the slot at head with a
+ * compare-and-swap, fills it in and publishes it by setting its sequence
+ * number to the position + 1. The writer owns tail and hands the slot back
+ * for the next lap by setting its sequence number to the position + size.
+ */
+struct uagent_debug_slot {
+	unsigned long seq;
+	size_t len;
+	char *ext; /* allocated text of a long message or %NULL */
+	char text[uagent_DEBUG_ASYNC_LINE_LEN];
+};
+
+struct uagent_debug_ring {
+	struct uagent_debug_slot *slots;
+	unsigned long mask;
+	unsigned long head; /* next position to claim */
+	unsigned long tail; /* next position to write, writer only */
+	int block;
+	int fd;
+	int stop;
+	unsigned long dropped;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int sleeping; /* writer is about to wait for the ring to fill */
+};
+
+static struct uagent_debug_ring uagent_debug_ring;
+static int uagent_debug_async;
+
+
 void uagent_debug_print_timestamp(void)
 {
 	struct os_time tv;
@@ -88,8 +124,337 @@ static int syslog_priority(int level)
 #endif /* CONFIG_DEBUG_SYSLOG */
 
 
+/* Timestamp prefix of a record, returns its length */
+static size_t uagent_debug_async_timestamp(char *buf, size_t size)
+{
+	struct os_time tv;
+	int res;
+
+	if (!uagent_debug_timestamp)
+		return 0;
+	os_get_time(&tv);
+	res = os_snprintf(buf, size, "%ld.%06u: ", (long) tv.sec,
+			  (unsigned int) tv.usec);
+	return res < 0 || (size_t) res >= size ? 0 : (size_t) res;
+}
+
+
+/* Claim the slot for the next record, or %NULL if the message is dropped */
+static struct uagent_debug_slot * uagent_debug_async_claim(unsigned long *_pos)
+{
+	struct uagent_debug_ring *r = &uagent_debug_ring;
+	struct uagent_debug_slot *slot;
+	unsigned long pos, seq;
+	long diff;
+
+	pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &r->slots[pos & r->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long) (seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The ring is full */
+			if (!r->block ||
+			    !__atomic_load_n(&uagent_debug_async,
+					     __ATOMIC_ACQUIRE)) {
+				__atomic_add_fetch(&r->dropped, 1,
+						   __ATOMIC_RELAXED);
+				return NULL;
+			}
+			sched_yield();
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		}
+	}
+	slot->ext = NULL;
+	*_pos = pos;
+	return slot;
+}
+
+
+/* Hand a filled in slot to the writer and wake it up if it sleeps */
+static void uagent_debug_async_publish(struct uagent_debug_slot *slot,
+				       unsigned long pos)
+{
+	struct uagent_debug_ring *r = &uagent_debug_ring;
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	/* Pairs with the fence in the writer before it checks for records */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&r->lock);
+		__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+		pthread_cond_signal(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+
+static void uagent_debug_async_vprintf(const char *fmt, va_list ap)
+{
+	struct uagent_debug_slot *slot;
+	size_t len, size = sizeof(slot->text);
+	unsigned long pos;
+	va_list ap2;
+	int res;
+
+	slot = uagent_debug_async_claim(&pos);
+	if (slot == NULL)
+		return;
+	len = uagent_debug_async_timestamp(slot->text, size);
+	va_copy(ap2, ap);
+	res = vsnprintf(slot->text + len, size - len, fmt, ap2);
+	va_end(ap2);
+	if (res < 0)
+		res = 0;
+	if (len + res + 1 <= size) {
+		/* Fits, newline included */
+		len += res;
+	} else {
+		slot->ext = os_malloc(len + res + 2);
+		if (slot->ext) {
+			os_memcpy(slot->ext, slot->text, len);
+			vsnprintf(slot->ext + len, res + 1, fmt, ap);
+			len += res;
+			slot->ext[len] = '\n';
+		} else {
+			/* Truncated */
+			len = size - 1;
+		}
+	}
+	if (slot->ext == NULL)
+		slot->text[len] = '\n';
+	slot->len = len + 1;
+	uagent_debug_async_publish(slot, pos);
+}
+
+
+/* Queue a complete message, @txt ending in a newline */
+static void uagent_debug_async_write(const char *txt, size_t txt_len)
+{
+	struct uagent_debug_slot *slot;
+	unsigned long pos;
+	size_t len;
+
+	slot = uagent_debug_async_claim(&pos);
+	if (slot == NULL)
+		return;
+	len = uagent_debug_async_timestamp(slot->text, sizeof(slot->text));
+	if (len + txt_len <= sizeof(slot->text)) {
+		os_memcpy(slot->text + len, txt, txt_len);
+		len += txt_len;
+	} else {
+		slot->ext = os_malloc(len + txt_len);
+		if (slot->ext) {
+			os_memcpy(slot->ext, slot->text, len);
+			os_memcpy(slot->ext + len, txt, txt_len);
+			len += txt_len;
+		} else {
+			/* Truncated */
+			os_memcpy(slot->text + len, txt,
+				  sizeof(slot->text) - len - 1);
+			len = sizeof(slot->text);
+			slot->text[len - 1] = '\n';
+		}
+	}
+	slot->len = len;
+	uagent_debug_async_publish(slot, pos);
+}
+
+
+static void uagent_debug_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t res;
+
+	while (iovcnt > 0) {
+		res = writev(fd, iov, iovcnt);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return; /* nowhere to report this */
+		}
+		while (iovcnt > 0 && (size_t) res >= iov->iov_len) {
+			res -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (u8 *) iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+}
+
+
+/* Write out the published records, returns the number written */
+static unsigned int uagent_debug_async_flush(struct uagent_debug_ring *r)
+{
+	struct iovec iov[uagent_DEBUG_ASYNC_BATCH + 1];
+	struct uagent_debug_slot *slot;
+	unsigned long dropped;
+	char msg[80];
+	unsigned int i, n = 0, total = 0;
+	int res;
+
+	for (;;) {
+		slot = &r->slots[(r->tail + n) & r->mask];
+		if (n < uagent_DEBUG_ASYNC_BATCH &&
+		    __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) ==
+		    r->tail + n + 1) {
+			iov[n].iov_base = slot->ext ? slot->ext : slot->text;
+			iov[n].iov_len = slot->len;
+			n++;
+			continue;
+		}
+		if (n == 0)
+			break;
+
+		/* Report drops once there was room again */
+		dropped = __atomic_exchange_n(&r->dropped, 0,
+					      __ATOMIC_RELAXED);
+		i = n;
+		if (dropped) {
+			res = os_snprintf(msg, sizeof(msg),
+					  "uagent_debug: %lu messages dropped\n",
+					  dropped);
+			if (res > 0 && (size_t) res < sizeof(msg)) {
+				iov[i].iov_base = msg;
+				iov[i].iov_len = res;
+				i++;
+			}
+		}
+		uagent_debug_writev(r->fd, iov, i);
+
+		for (i = 0; i < n; i++) {
+			slot = &r->slots[r->tail & r->mask];
+			os_free(slot->ext);
+			slot->ext = NULL;
+			__atomic_store_n(&slot->seq, r->tail + r->mask + 1,
+					 __ATOMIC_RELEASE);
+			r->tail++;
+		}
+		total += n;
+		n = 0;
+	}
+	return total;
+}
+
+
+static void * uagent_debug_async_thread(void *arg)
+{
+	struct uagent_debug_ring *r = arg;
+	struct uagent_debug_slot *slot;
+	struct timespec ts;
+
+	for (;;) {
+		if (uagent_debug_async_flush(r))
+			continue;
+		if (__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+			break;
+
+		/*
+		 * Announce the wait, then check again so that a record
+		 * published in between is not missed; the timeout only bounds
+		 * the delay of drop reports.
+		 */
+		__atomic_store_n(&r->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		slot = &r->slots[r->tail & r->mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) ==
+		    r->tail + 1 || __atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		pthread_mutex_lock(&r->lock);
+		while (__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED) &&
+		       pthread_cond_timedwait(&r->cond, &r->lock, &ts) == 0)
+			;
+		__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
+
+
+int uagent_debug_async_start(unsigned int records, int block)
+{
+	struct uagent_debug_ring *r = &uagent_debug_ring;
+	static int registered;
+	unsigned long i, size = 1;
+
+	if (uagent_debug_async)
+		return 0;
+	if (records == 0)
+		records = uagent_DEBUG_ASYNC_RECORDS;
+	while (size < records)
+		size <<= 1;
+
+	/*
+	 * A thread may still be in uagent_printf() with the ring after
+	 * uagent_debug_async_stop(), so the slots of an earlier start are kept
+	 * and reused.
+	 */
+	if (r->slots == NULL) {
+		r->slots = os_calloc(size, sizeof(*r->slots));
+		if (r->slots == NULL)
+			return -1;
+		r->mask = size - 1;
+		pthread_mutex_init(&r->lock, NULL);
+		pthread_cond_init(&r->cond, NULL);
+	}
+	for (i = 0; i <= r->mask; i++)
+		r->slots[(r->tail + i) & r->mask].seq = r->tail + i;
+	r->head = r->tail;
+	r->block = block;
+	r->stop = 0;
+	r->sleeping = 0;
+#ifdef CONFIG_DEBUG_FILE
+	if (out_file) {
+		fflush(out_file);
+		r->fd = fileno(out_file);
+	} else
+#endif /* CONFIG_DEBUG_FILE */
+	{
+		fflush(stdout);
+		r->fd = STDOUT_FILENO;
+	}
+
+	if (pthread_create(&r->thread, NULL, uagent_debug_async_thread, r) !=
+	    0)
+		return -1;
+	if (!registered && atexit(uagent_debug_async_stop) == 0)
+		registered = 1;
+	__atomic_store_n(&uagent_debug_async, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+void uagent_debug_async_stop(void)
+{
+	struct uagent_debug_ring *r = &uagent_debug_ring;
+
+	if (!uagent_debug_async)
+		return;
+	__atomic_store_n(&uagent_debug_async, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&r->lock);
+	__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+}
+
+
 /**
- * uagent_printf - conditional printf
+ * uagent_debug_printf - conditional printf
  * @level: priority level (MSG_*) of the message
  * @fmt: printf format string, followed by optional arguments
  *
@@ -99,7 +464,7 @@ static int syslog_priority(int level)
  *
  * Note: New line '\n' is added to the end of the text when printing to stdout.
  */
-void uagent_printf(int level, const char *fmt, ...)
+void uagent_debug_printf(int level, const char *fmt, ...)
 {
 	va_list ap;
 
@@ -108,8 +473,11 @@ void uagent_printf(int level, const char *fmt, ...)
 #ifdef CONFIG_DEBUG_SYSLOG
 		if (uagent_debug_syslog) {
 			vsyslog(syslog_priority(level), fmt, ap);
-		} else {
+		} else
 #endif /* CONFIG_DEBUG_SYSLOG */
+		if (__atomic_load_n(&uagent_debug_async, __ATOMIC_ACQUIRE)) {
+			uagent_debug_async_vprintf(fmt, ap);
+		} else {
 		uagent_debug_print_timestamp();
 #ifdef CONFIG_DEBUG_FILE
 		if (out_file) {
@@ -122,22 +490,159 @@ void uagent_printf(int level, const char *fmt, ...)
 #ifdef CONFIG_DEBUG_FILE
 		}
 #endif /* CONFIG_DEBUG_FILE */
-#ifdef CONFIG_DEBUG_SYSLOG
 		}
-#endif /* CONFIG_DEBUG_SYSLOG */
 	}
 	va_end(ap);
 
 }
 
 
+int uagent_ratelimit(struct uagent_ratelimit *rl, int level, const char *file,
+		     int line)
+{
+	struct os_reltime now, age;
+	unsigned long suppressed;
+	unsigned int add;
+
+	/* A call site raced by another thread just counts the message */
+	if (__atomic_test_and_set(&rl->busy, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &rl->last, &age);
+	if (age.sec >= uagent_DEBUG_RATELIMIT_BURST)
+		add = uagent_DEBUG_RATELIMIT_BURST * 1000;
+	else
+		add = (age.sec * 1000 + age.usec / 1000) *
+			uagent_DEBUG_RATELIMIT_PER_SEC;
+	if (add) {
+		rl->tokens += add;
+		if (rl->tokens > uagent_DEBUG_RATELIMIT_BURST * 1000)
+			rl->tokens = uagent_DEBUG_RATELIMIT_BURST * 1000;
+		rl->last = now;
+	}
+	if (rl->tokens < 1000) {
+		__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+		__atomic_clear(&rl->busy, __ATOMIC_RELEASE);
+		return 0;
+	}
+	rl->tokens -= 1000;
+	suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	__atomic_clear(&rl->busy, __ATOMIC_RELEASE);
+
+	if (suppressed)
+		uagent_debug_printf(level, "%s:%d: %lu messages suppressed",
+				    file, line, suppressed);
+	return 1;
+}
+
+
+/*
+ * Format a hexdump the way it is printed, ending in a newline. Returns the text
+ * allocated with os_malloc() and its length in @txt_len, or %NULL on failure.
+ */
+static char * uagent_debug_hexdump_text(const char *title, const u8 *buf,
+					size_t len, int show, size_t *txt_len)
+{
+	char *txt;
+	size_t size, pos;
+	int res;
+
+	size = os_strlen(title) + 40 + (buf && show ? 3 * len : 0);
+	txt = os_malloc(size);
+	if (txt == NULL)
+		return NULL;
+	res = os_snprintf(txt, size, "%s - hexdump(len=%lu):%s\n", title,
+			  (unsigned long) len,
+			  buf == NULL ? " [NULL]" : (show ? "" : " [REMOVED]"));
+	if (res < 0 || (size_t) res >= size) {
+		os_free(txt);
+		return NULL;
+	}
+	pos = res;
+	if (buf && show) {
+		/* The hex dump goes in front of the newline */
+		pos += wpa_hex_encode(txt + pos - 1, buf, len, ' ', 0);
+		txt[pos - 1] = '\n';
+	}
+	*txt_len = pos;
+	return txt;
+}
+
+
+static char * uagent_debug_hexdump_ascii_text(const char *title, const u8 *buf,
+					      size_t len, int show,
+					      size_t *txt_len)
+{
+	const size_t line_len = 16;
+	size_t size, pos, i, llen;
+	char *txt;
+	int res;
+
+	size = os_strlen(title) + 50;
+	if (buf && show)
+		size += (len + line_len - 1) / line_len * (8 + 4 * line_len);
+	txt = os_malloc(size);
+	if (txt == NULL)
+		return NULL;
+	res = os_snprintf(txt, size, "%s - hexdump_ascii(len=%lu):%s\n", title,
+			  (unsigned long) len,
+			  !show ? " [REMOVED]" : (buf == NULL ? " [NULL]" : ""));
+	if (res < 0 || (size_t) res >= size) {
+		os_free(txt);
+		return NULL;
+	}
+	pos = res;
+	while (buf && show && len) {
+		llen = len > line_len ? line_len : len;
+		os_memcpy(txt + pos, "    ", 4);
+		pos += 4;
+		pos += wpa_hex_encode(txt + pos, buf, llen, ' ', 0);
+		os_memset(txt + pos, ' ', 3 * (line_len - llen) + 3);
+		pos += 3 * (line_len - llen) + 3;
+		for (i = 0; i < llen; i++)
+			txt[pos++] = isprint(buf[i]) ? buf[i] : '_';
+		os_memset(txt + pos, ' ', line_len - llen);
+		pos += line_len - llen;
+		txt[pos++] = '\n';
+		buf += llen;
+		len -= llen;
+	}
+	*txt_len = pos;
+	return txt;
+}
+
+
+/* Print formatted text ending in a newline with a single write */
+static void uagent_debug_print_text(const char *txt, size_t len)
+{
+	if (__atomic_load_n(&uagent_debug_async, __ATOMIC_ACQUIRE)) {
+		uagent_debug_async_write(txt, len);
+		return;
+	}
+	uagent_debug_print_timestamp();
+#ifdef CONFIG_DEBUG_FILE
+	if (out_file) {
+		fwrite(txt, 1, len, out_file);
+		return;
+	}
+#endif /* CONFIG_DEBUG_FILE */
+	fwrite(txt, 1, len, stdout);
+}
+
+
 static void _uagent_hexdump(int level, const char *title, const u8 *buf,
 			 size_t len, int show)
 {
-	size_t i;
+	size_t txt_len;
+	char *txt;
 
 #ifdef CONFIG_DEBUG_LINUX_TRACING*/
 	if (uagent_debug_tracing_file != NULL) {
+		size_t i;
+
 		fprintf(uagent_debug_tracing_file,
 			uagentS_TRACE_PFX "%s - hexdump(len=%lu):",
 			level, title, (unsigned long) len);
@@ -174,9 +679,7 @@ static void _uagent_hexdump(int level, const char *title, const u8 *buf,
 				return;
 			}
 
-			for (i = 0; i < len; i++)
-				os_snprintf(&strbuf[i * 3], 4, " %02x",
-					    buf[i]);
+			strbuf[wpa_hex_encode(strbuf, buf, len, ' ', 0)] = '\0';
 
 			display = strbuf;
 		} else {
@@ -189,38 +692,15 @@ static void _uagent_hexdump(int level, const char *title, const u8 *buf,
 		return;
 	}
 #endif /* CONFIG_DEBUG_SYSLOG */
-	uagent_debug_print_timestamp();
-#ifdef CONFIG_DEBUG_FILE
-	if (out_file) {
-		fprintf(out_file, "%s - hexdump(len=%lu):",
-			title, (unsigned long) len);
-		if (buf == NULL) {
-			fprintf(out_file, " [NULL]");
-		} else if (show) {
-			for (i = 0; i < len; i++)
-				fprintf(out_file, " %02x", buf[i]);
-		} else {
-			fprintf(out_file, " [REMOVED]");
-		}
-		fprintf(out_file, "\n");
-	} else {
-#endif /* CONFIG_DEBUG_FILE */
-	printf("%s - hexdump(len=%lu):", title, (unsigned long) len);
-	if (buf == NULL) {
-		printf(" [NULL]");
-	} else if (show) {
-		for (i = 0; i < len; i++)
-			printf(" %02x", buf[i]);
-	} else {
-		printf(" [REMOVED]");
-	}
-	printf("\n");
-#ifdef CONFIG_DEBUG_FILE
-	}
-#endif /* CONFIG_DEBUG_FILE */
+	txt = uagent_debug_hexdump_text(title, buf, len, show, &txt_len);
+	if (txt == NULL)
+		return;
+	uagent_debug_print_text(txt, txt_len);
+	os_free(txt);
 }
 
-void uagent_hexdump(int level, const char *title, const u8 *buf, size_t len)
+void uagent_debug_hexdump(int level, const char *title, const u8 *buf,
+			  size_t len)
 {
 	_uagent_hexdump(level, title, buf, len, 1);
 }
@@ -230,12 +710,13 @@ void uagent_hexdump(int level, const char *title, const u8 *buf, size_t len)
 static void _uagent_hexdump_ascii(int level, const char *title, const u8 *buf,
 			       size_t len, int show)
 {
-	size_t i, llen;
-	const u8 *pos = buf;
-	const size_t line_len = 16;
+	size_t txt_len;
+	char *txt;
 #ifdef CONFIG_DEBUG_LINUX_TRACING*/
 
 	if (uagent_debug_tracing_file != NULL) {
+		size_t i;
+
 		fprintf(uagent_debug_tracing_file,
 			uagentS_TRACE_PFX "%s - hexdump_ascii(len=%lu):",
 			level, title, (unsigned long) len);
@@ -254,83 +735,16 @@ static void _uagent_hexdump_ascii(int level, const char *title, const u8 *buf,
 #endif /* CONFIG_DEBUG_LINUX_TRACING */
 	if (level < uagent_debug_level)
 		return;
-	uagent_debug_print_timestamp();
-#ifdef CONFIG_DEBUG_FILE
-	if (out_file) {
-		if (!show) {
-			fprintf(out_file,
-				"%s - hexdump_ascii(len=%lu): [REMOVED]\n",
-				title, (unsigned long) len);
-			return;
-		}
-		if (buf == NULL) {
-			fprintf(out_file,
-				"%s - hexdump_ascii(len=%lu): [NULL]\n",
-				title, (unsigned long) len);
-			return;
-		}
-		fprintf(out_file, "%s - hexdump_ascii(len=%lu):\n",
-			title, (unsigned long) len);
-		while (len) {
-			llen = len > line_len ? line_len : len;
-			fprintf(out_file, "    ");
-			for (i = 0; i < llen; i++)
-				fprintf(out_file, " %02x", pos[i]);
-			for (i = llen; i < line_len; i++)
-				fprintf(out_file, "   ");
-			fprintf(out_file, "   ");
-			for (i = 0; i < llen; i++) {
-				if (isprint(pos[i]))
-					fprintf(out_file, "%c", pos[i]);
-				else
-					fprintf(out_file, "_");
-			}
-			for (i = llen; i < line_len; i++)
-				fprintf(out_file, " ");
-			fprintf(out_file, "\n");
-			pos += llen;
-			len -= llen;
-		}
-	} else {
-#endif /* CONFIG_DEBUG_FILE */
-	if (!show) {
-		printf("%s - hexdump_ascii(len=%lu): [REMOVED]\n",
-		       title, (unsigned long) len);
-		return;
-	}
-	if (buf == NULL) {
-		printf("%s - hexdump_ascii(len=%lu): [NULL]\n",
-		       title, (unsigned long) len);
+	txt = uagent_debug_hexdump_ascii_text(title, buf, len, show, &txt_len);
+	if (txt == NULL)
 		return;
-	}
-	printf("%s - hexdump_ascii(len=%lu):\n", title, (unsigned long) len);
-	while (len) {
-		llen = len > line_len ? line_len : len;
-		printf("    ");
-		for (i = 0; i < llen; i++)
-			printf(" %02x", pos[i]);
-		for (i = llen; i < line_len; i++)
-			printf("   ");
-		printf("   ");
-		for (i = 0; i < llen; i++) {
-			if (isprint(pos[i]))
-				printf("%c", pos[i]);
-			else
-				printf("_");
-		}
-		for (i = llen; i < line_len; i++)
-			printf(" ");
-		printf("\n");
-		pos += llen;
-		len -= llen;
-	}
-#ifdef CONFIG_DEBUG_FILE
-	}
-#endif /* CONFIG_DEBUG_FILE */
+	uagent_debug_print_text(txt, txt_len);
+	os_free(txt);
 }
 
 
-void uagent_hexdump_ascii(int level, const char *title, const u8 *buf, size_t len)
+void uagent_debug_hexdump_ascii(int level, const char *title, const u8 *buf,
+				size_t len)
 {
 	_uagent_hexdump_ascii(level, title, buf, len, 1);
 }
@@ -13,16 +13,39 @@
 
 /* Debugging function - conditional printf and hex dump. Driver wrappers can
  * use these for debugging purposes. */
-extern uagent_debug_level;
+extern int uagent_debug_level;
 enum {
 	MSG_INFO, MSG_WARNING, MSG_ERROR
 };
 
+/*
+ * Messages below this level are compiled out, e.g., build with
+ * -DCONFIG_DEBUG_MIN_LEVEL=MSG_WARNING to drop all MSG_INFO calls including
+ * the evaluation of their arguments
+ */
+#ifndef CONFIG_DEBUG_MIN_LEVEL
+#define CONFIG_DEBUG_MIN_LEVEL MSG_INFO
+#endif /* CONFIG_DEBUG_MIN_LEVEL */
+
+/* Messages a rate limited call site may print per second ... */
+#define uagent_DEBUG_RATELIMIT_PER_SEC 10
+/* ... and in a burst after being quiet */
+#define uagent_DEBUG_RATELIMIT_BURST 20
+
+/* Records in the ring of the asynchronous log writer */
+#define uagent_DEBUG_ASYNC_RECORDS 1024
+/* Text kept in a ring record; longer messages are allocated separately */
+#define uagent_DEBUG_ASYNC_LINE_LEN 232
+/* Records written with one writev() by the log writer */
+#define uagent_DEBUG_ASYNC_BATCH 64
+
 #ifdef CONFIG_NO_STDOUT_DEBUG
 
 #define uagent_debug_print_timestamp() do { } while (0)
 #define uagent_printf(args...) do { } while (0)
+#define uagent_printf_ratelimited(args...) do { } while (0)
 #define uagent_hexdump(l,t,b,le) do { } while (0)
+#define uagent_hexdump_ratelimited(l,t,b,le) do { } while (0)
 #define uagent_hexdump_buf(l,t,b) do { } while (0)
 #define uagent_hexdump_key(l,t,b,le) do { } while (0)
 #define uagent_hexdump_buf_key(l,t,b) do { } while (0)
@@ -37,12 +60,45 @@ static inline int uagent_debug_reopen_file(void)
 	return 0;
 }
 
+static inline int uagent_debug_async_start(unsigned int records, int block)
+{
+	return 0;
+}
+
+static inline void uagent_debug_async_stop(void)
+{
+}
+
 #else /* CONFIG_NO_STDOUT_DEBUG */
 
 int uagent_debug_open_file(const char *path);
 int uagent_debug_reopen_file(void);
 void uagent_debug_close_file(void);
 
+/**
+ * uagent_debug_async_start - Write debug output from a separate thread
+ * @records: Number of records in the ring, rounded up to a power of two, or
+ *	0 for %uagent_DEBUG_ASYNC_RECORDS
+ * @block: What to do when the ring is full: 0 to drop the message and count
+ *	it, 1 to wait for the writer
+ * Returns: 0 on success, -1 on failure
+ *
+ * From now on, uagent_printf() and the hex dumps format the message into a
+ * lock-free ring and return; a writer thread writes the records out in
+ * batches with writev(). The number of dropped messages is reported in the
+ * output once there is room again. Syslog output stays synchronous. The debug
+ * file, if any, must be opened before this is called.
+ */
+int uagent_debug_async_start(unsigned int records, int block);
+
+/**
+ * uagent_debug_async_stop - Write out the queued debug output and stop
+ *
+ * Debug output is written synchronously again afterwards. This is also done
+ * at exit().
+ */
+void uagent_debug_async_stop(void);
+
 /**
  * uagent_debug_printf_timestamp - Print timestamp for debug output
  *
@@ -52,6 +108,59 @@ void uagent_debug_close_file(void);
  */
 void uagent_debug_print_timestamp(void);
 
+/**
+ * struct uagent_ratelimit - Token bucket of a rate limited call site
+ * @tokens: Messages that may be printed now, in thousandths
+ * @last: Time of the last refill
+ * @suppressed: Messages dropped since the last one printed
+ * @busy: Taken while the bucket is updated
+ *
+ * Zero initialized, which gives a full bucket.
+ */
+struct uagent_ratelimit {
+	unsigned int tokens;
+	struct os_reltime last;
+	unsigned long suppressed;
+	char busy;
+};
+
+/**
+ * uagent_ratelimit - Check the rate limit of a call site
+ * @rl: Token bucket of the call site
+ * @level: priority level (MSG_*) for the summary of suppressed messages
+ * @file: Source file of the call site
+ * @line: Source line of the call site
+ * Returns: 1 if the message may be printed, 0 if it is suppressed
+ *
+ * When a message may be printed after others were suppressed, a line telling
+ * how many is printed first.
+ */
+int uagent_ratelimit(struct uagent_ratelimit *rl, int level, const char *file,
+		     int line);
+
+/**
+ * uagent_debug_printf - printf for debug output
+ * @level: priority level (MSG_*) of the message
+ * @fmt: printf format string, followed by optional arguments
+ *
+ * This is the function behind uagent_printf(), which should be used instead.
+ */
+void uagent_debug_printf(int level, const char *fmt, ...)
+PRINTF_FORMAT(2, 3);
+
+/**
+ * uagent_debug_enabled - Check whether a message would be printed
+ * @level: priority level (MSG_*) of the message
+ * Returns: 1 if uagent_printf() prints messages of this level
+ *
+ * Warnings and errors are printed at any debug level.
+ */
+static inline int uagent_debug_enabled(int level)
+{
+	return level >= CONFIG_DEBUG_MIN_LEVEL &&
+		(level >= uagent_debug_level || level >= MSG_WARNING);
+}
+
 /**
  * uagent_printf - conditional printf
  * @level: priority level (MSG_*) of the message
@@ -59,12 +168,38 @@ void uagent_debug_print_timestamp(void);
  *
  * This function is used to print conditional debugging and error messages. The
  * output may be directed to stdout, stderr, and/or syslog based on
- * configuration.
+ * configuration. The level is checked before the arguments are evaluated, and
+ * calls below %CONFIG_DEBUG_MIN_LEVEL are compiled out.
  *
  * Note: New line '\n' is added to the end of the text when printing to stdout.
  */
-void uagent_printf(int level, const char *fmt, ...)
-PRINTF_FORMAT(2, 3);
+#define uagent_printf(level, args...)					\
+	do {								\
+		if (uagent_debug_enabled(level))			\
+			uagent_debug_printf(level, args);		\
+	} while (0)
+
+/**
+ * uagent_printf_ratelimited - conditional printf, rate limited per call site
+ * @level: priority level (MSG_*) of the message
+ * @fmt: printf format string, followed by optional arguments
+ *
+ * Like uagent_printf(), but each call site prints at most
+ * %uagent_DEBUG_RATELIMIT_PER_SEC messages per second on average, in bursts
+ * of up to %uagent_DEBUG_RATELIMIT_BURST. Meant for messages that a peer can
+ * trigger at will, e.g., one per received frame.
+ */
+#define uagent_printf_ratelimited(level, args...)			\
+	do {								\
+		static struct uagent_ratelimit _rl;			\
+		if (uagent_debug_enabled(level) &&			\
+		    uagent_ratelimit(&_rl, level, __FILE__, __LINE__))	\
+			uagent_debug_printf(level, args);		\
+	} while (0)
+
+/* Behind uagent_hexdump(), which should be used instead */
+void uagent_debug_hexdump(int level, const char *title, const u8 *buf,
+			  size_t len);
 
 /**
  * uagent_hexdump - conditional hex dump
@@ -77,7 +212,30 @@ PRINTF_FORMAT(2, 3);
  * output may be directed to stdout, stderr, and/or syslog based on
  * configuration. The contents of buf is printed out has hex dump.
  */
-void uagent_hexdump(int level, const char *title, const u8 *buf, size_t len);
+#define uagent_hexdump(level, title, buf, len)				\
+	do {								\
+		if ((level) >= CONFIG_DEBUG_MIN_LEVEL &&		\
+		    (level) >= uagent_debug_level)			\
+			uagent_debug_hexdump(level, title, buf, len);	\
+	} while (0)
+
+/**
+ * uagent_hexdump_ratelimited - conditional hex dump, rate limited per call site
+ * @level: priority level (MSG_*) of the message
+ * @title: title of for the message
+ * @buf: data buffer to be dumped
+ * @len: length of the buf
+ *
+ * Like uagent_hexdump(), with the rate limit of uagent_printf_ratelimited().
+ */
+#define uagent_hexdump_ratelimited(level, title, buf, len)		\
+	do {								\
+		static struct uagent_ratelimit _rl;			\
+		if ((level) >= CONFIG_DEBUG_MIN_LEVEL &&		\
+		    (level) >= uagent_debug_level &&			\
+		    uagent_ratelimit(&_rl, level, __FILE__, __LINE__))	\
+			uagent_debug_hexdump(level, title, buf, len);	\
+	} while (0)
 
 static inline void uagent_hexdump_buf(int level, const char *title,
 				   const struct uagentbuf *buf)
@@ -108,6 +266,10 @@ static inline void uagent_hexdump_buf_key(int level, const char *title,
 			buf ? uagentbuf_len(buf) : 0);
 }
 
+/* Behind uagent_hexdump_ascii(), which should be used instead */
+void uagent_debug_hexdump_ascii(int level, const char *title, const u8 *buf,
+				size_t len);
+
 /**
  * uagent_hexdump_ascii - conditional hex dump
  * @level: priority level (MSG_*) of the message
@@ -121,8 +283,12 @@ static inline void uagent_hexdump_buf_key(int level, const char *title,
  * the hex numbers and ASCII characters (for printable range) are shown. 16
  * bytes per line will be shown.
  */
-void uagent_hexdump_ascii(int level, const char *title, const u8 *buf,
-		       size_t len);
+#define uagent_hexdump_ascii(level, title, buf, len)			\
+	do {								\
+		if ((level) >= CONFIG_DEBUG_MIN_LEVEL &&		\
+		    (level) >= uagent_debug_level)			\
+			uagent_debug_hexdump_ascii(level, title, buf, len); \
+	} while (0)
 
 /**
  * uagent_hexdump_ascii_key - conditional hex dump, hide keys
@@ -26,6 +26,151 @@ static struct uagentbuf_trace * uagentbuf_get_trace(const struct uagentbuf *buf)
 }
 #endif /* uagent_TRACE */
 
+/*
+ * Buffers are recycled through a pool unless disabled at build time. Tracing
+ * needs every buffer to go through os_malloc()/os_free() to catch misuse, so
+ * it turns the pool off as well.
+ */
+#if !defined(CONFIG_NO_UAGENTBUF_POOL) && !defined(uagent_TRACE)
+#define uagentBUF_POOL
+#endif
+
+#ifdef uagentBUF_POOL
+/*
+ * Each thread, i.e., each select loop, has its own pool, so no locking is
+ * needed. Size class n holds blocks with room for 1 << (n +
+ * uagentBUF_POOL_MIN_SHIFT) octets of data, kept on a free list linked through
+ * uagentbuf::buf. A buffer freed by another thread than the one that
+ * allocated it is handed back to os_free().
+ */
+struct uagentbuf_pool {
+	struct uagentbuf *free[uagentBUF_POOL_CLASSES];
+	unsigned int count[uagentBUF_POOL_CLASSES];
+	struct uagentbuf_pool_stats stats;
+};
+
+static __thread struct uagentbuf_pool uagentbuf_pool;
+
+
+static size_t uagentbuf_pool_class_size(unsigned int cls)
+{
+	return (size_t) 1 << (cls + uagentBUF_POOL_MIN_SHIFT);
+}
+
+
+/* Smallest class for @len octets, uagentBUF_POOL_CLASSES if none */
+static unsigned int uagentbuf_pool_class(size_t len)
+{
+	unsigned int cls = 0;
+
+	while (cls < uagentBUF_POOL_CLASSES &&
+	       uagentbuf_pool_class_size(cls) < len)
+		cls++;
+	return cls;
+}
+
+
+/* Longest free list of a class, so that the pool cannot hoard memory */
+static unsigned int uagentbuf_pool_max_free(unsigned int cls)
+{
+	size_t max = uagentBUF_POOL_CLASS_BYTES / uagentbuf_pool_class_size(cls);
+
+	return max < uagentBUF_POOL_MIN_FREE ? uagentBUF_POOL_MIN_FREE : max;
+}
+
+
+/* Get a block for @len octets of data, %NULL if it is too large */
+static struct uagentbuf * uagentbuf_pool_get(size_t len)
+{
+	struct uagentbuf_pool *pool = &uagentbuf_pool;
+	unsigned int cls = uagentbuf_pool_class(len);
+	struct uagentbuf *buf;
+
+	if (cls == uagentBUF_POOL_CLASSES) {
+		pool->stats.oversize++;
+		return NULL;
+	}
+	buf = pool->free[cls];
+	if (buf) {
+		pool->free[cls] = (struct uagentbuf *) buf->buf;
+		pool->count[cls]--;
+		pool->stats.hits++;
+		pool->stats.cached--;
+		pool->stats.cached_bytes -= uagentbuf_pool_class_size(cls);
+	} else {
+		buf = os_malloc(sizeof(*buf) + uagentbuf_pool_class_size(cls));
+		if (buf == NULL)
+			return NULL;
+		pool->stats.misses++;
+	}
+	buf->pool = pool;
+	buf->pool_class = cls;
+	return buf;
+}
+
+
+/* Returns 0 if @buf was taken back, -1 if it must go to os_free() */
+static int uagentbuf_pool_put(struct uagentbuf *buf)
+{
+	struct uagentbuf_pool *pool = &uagentbuf_pool;
+	unsigned int cls = buf->pool_class;
+
+	if (buf->pool != pool) {
+		if (buf->pool)
+			pool->stats.foreign++;
+		return -1;
+	}
+	if (pool->count[cls] >= uagentbuf_pool_max_free(cls))
+		return -1;
+	buf->buf = (u8 *) pool->free[cls];
+	pool->free[cls] = buf;
+	pool->count[cls]++;
+	pool->stats.cached++;
+	pool->stats.cached_bytes += uagentbuf_pool_class_size(cls);
+	return 0;
+}
+#endif /* uagentBUF_POOL */
+
+
+/**
+ * uagentbuf_pool_get_stats - Get the buffer pool statistics of this thread
+ * @stats: Buffer for the statistics; all zero if the pool is disabled
+ */
+void uagentbuf_pool_get_stats(struct uagentbuf_pool_stats *stats)
+{
+#ifdef uagentBUF_POOL
+	*stats = uagentbuf_pool.stats;
+#else /* uagentBUF_POOL */
+	os_memset(stats, 0, sizeof(*stats));
+#endif /* uagentBUF_POOL */
+}
+
+
+/**
+ * uagentbuf_pool_trim - Release the buffers cached by the pool of this thread
+ *
+ * To be called before a thread that used uagentbufs exits, or to give memory
+ * back after a burst.
+ */
+void uagentbuf_pool_trim(void)
+{
+#ifdef uagentBUF_POOL
+	struct uagentbuf_pool *pool = &uagentbuf_pool;
+	struct uagentbuf *buf;
+	unsigned int cls;
+
+	for (cls = 0; cls < uagentBUF_POOL_CLASSES; cls++) {
+		while ((buf = pool->free[cls]) != NULL) {
+			pool->free[cls] = (struct uagentbuf *) buf->buf;
+			os_free(buf);
+		}
+		pool->count[cls] = 0;
+	}
+	pool->stats.cached = 0;
+	pool->stats.cached_bytes = 0;
+#endif /* uagentBUF_POOL */
+}
+
 
 static void uagentbuf_overflow(const struct uagentbuf *buf, size_t len)
 {
@@ -44,15 +189,33 @@ static void uagentbuf_overflow(const struct uagentbuf *buf, size_t len)
 }
 
 
-int uagentbuf_resize(struct uagentbuf **_buf, size_t add_len)
+/*
+ * Size to grow to for @add_len more octets: at least half again the current
+ * size, so that a buffer grown by many small appends is reallocated, and
+ * copied, only O(log n) times.
+ */
+static size_t uagentbuf_grow_size(const struct uagentbuf *buf, size_t add_len)
+{
+	size_t need = buf->used + add_len;
+	size_t size = buf->size + buf->size / 2;
+
+	if (size < uagentBUF_MIN_GROW)
+		size = uagentBUF_MIN_GROW;
+	return size < need ? need : size;
+}
+
+
+static int uagentbuf_grow(struct uagentbuf **_buf, size_t add_len, int zero)
 {
 	struct uagentbuf *buf = *_buf;
+	size_t size, headroom;
 #ifdef uagent_TRACE
 	struct uagentbuf_trace *trace;
 #endif /* uagent_TRACE */
 
 	if (buf == NULL) {
-		*_buf = uagentbuf_alloc(add_len);
+		*_buf = zero ? uagentbuf_alloc(add_len) :
+			uagentbuf_alloc_nozero(add_len);
 		return *_buf == NULL ? -1 : 0;
 	}
 
@@ -68,37 +231,72 @@ int uagentbuf_resize(struct uagentbuf **_buf, size_t add_len)
 
 	if (buf->used + add_len > buf->size) {
 		unsigned char *nbuf;
+		size = uagentbuf_grow_size(buf, add_len);
+		headroom = uagentbuf_headroom(buf);
+		if (buf->shared) {
+			struct uagentbuf *n;
+
+			/* Shared data is immutable, the writer gets a copy */
+			n = uagentbuf_alloc_nozero(size);
+			if (n == NULL)
+				return -1;
+			uagentbuf_put_buf(n, buf);
+			if (zero)
+				os_memset(n->buf + n->used, 0, size - n->used);
+			uagentbuf_free(buf);
+			*_buf = n;
+			return 0;
+		}
+#ifdef uagentBUF_POOL
+		if (buf->pool) {
+			struct uagentbuf *n;
+
+			/* Pool blocks cannot be reallocated, but may have room */
+			if (headroom + size >
+			    uagentbuf_pool_class_size(buf->pool_class)) {
+				n = uagentbuf_alloc_headroom(headroom, size);
+				if (n == NULL)
+					return -1;
+				os_memcpy(n->buf, buf->buf, buf->used);
+				n->used = buf->used;
+				uagentbuf_free(buf);
+				buf = n;
+				*_buf = buf;
+			}
+			if (zero)
+				os_memset(buf->buf + buf->used, 0,
+					  size - buf->used);
+			buf->size = size;
+			return 0;
+		}
+#endif /* uagentBUF_POOL */
 		if (buf->flags & uagentBUF_FLAG_EXT_DATA) {
-			nbuf = os_realloc(buf->buf, buf->used + add_len);
+			nbuf = os_realloc(buf->buf, size);
 			if (nbuf == NULL)
 				return -1;
-			os_memset(nbuf + buf->used, 0, add_len);
 			buf->buf = nbuf;
 		} else {
 #ifdef uagent_TRACE
 			nbuf = os_realloc(trace, sizeof(struct uagentbuf_trace) +
-					  sizeof(struct uagentbuf) +
-					  buf->used + add_len);
+					  sizeof(struct uagentbuf) + headroom +
+					  size);
 			if (nbuf == NULL)
 				return -1;
 			trace = (struct uagentbuf_trace *) nbuf;
 			buf = (struct uagentbuf *) (trace + 1);
-			os_memset(nbuf + sizeof(struct uagentbuf_trace) +
-				  sizeof(struct uagentbuf) + buf->used, 0,
-				  add_len);
 #else /* uagent_TRACE */
-			nbuf = os_realloc(buf, sizeof(struct uagentbuf) +
-					  buf->used + add_len);
+			nbuf = os_realloc(buf, sizeof(struct uagentbuf) + headroom +
+					  size);
 			if (nbuf == NULL)
 				return -1;
 			buf = (struct uagentbuf *) nbuf;
-			os_memset(nbuf + sizeof(struct uagentbuf) + buf->used, 0,
-				  add_len);
 #endif /* uagent_TRACE */
-			buf->buf = (u8 *) (buf + 1);
+			buf->buf = (u8 *) (buf + 1) + headroom;
 			*_buf = buf;
 		}
-		buf->size = buf->used + add_len;
+		if (zero)
+			os_memset(buf->buf + buf->used, 0, size - buf->used);
+		buf->size = size;
 	}
 
 	return 0;
@@ -106,32 +304,132 @@ int uagentbuf_resize(struct uagentbuf **_buf, size_t add_len)
 
 
 /**
- * uagentbuf_alloc - Allocate a uagentbuf of the given size
- * @len: Length for the allocated buffer
- * Returns: Buffer to the allocated uagentbuf or %NULL on failure
+ * uagentbuf_resize - Make room for more data in a buffer
+ * @_buf: Pointer to the buffer, updated if it is reallocated; a %NULL buffer
+ *	is allocated
+ * @add_len: Number of octets needed as tail room
+ * Returns: 0 on success, -1 on failure
+ *
+ * The buffer grows geometrically, so it may end up with more tail room than
+ * asked for. New tail room is zeroed.
  */
-struct uagentbuf * uagentbuf_alloc(size_t len)
+int uagentbuf_resize(struct uagentbuf **_buf, size_t add_len)
+{
+	return uagentbuf_grow(_buf, add_len, 1);
+}
+
+
+/**
+ * uagentbuf_reserve - Make room for more data without zeroing it
+ * @_buf: Pointer to the buffer, updated if it is reallocated; a %NULL buffer
+ *	is allocated
+ * @add_len: Number of octets needed as tail room
+ * Returns: 0 on success, -1 on failure
+ *
+ * Like uagentbuf_resize(), but new tail room is left uninitialized. This is
+ * for callers that overwrite it anyway, e.g., with uagentbuf_put_*() or read().
+ */
+int uagentbuf_reserve(struct uagentbuf **_buf, size_t add_len)
+{
+	return uagentbuf_grow(_buf, add_len, 0);
+}
+
+
+static struct uagentbuf * uagentbuf_alloc_internal(size_t headroom,
+						 size_t len, int zero)
 {
 #ifdef uagent_TRACE
-	struct uagentbuf_trace *trace = os_zalloc(sizeof(struct uagentbuf_trace) +
-					       sizeof(struct uagentbuf) + len);
+	struct uagentbuf_trace *trace;
 	struct uagentbuf *buf;
+
+	if (zero)
+		trace = os_zalloc(sizeof(struct uagentbuf_trace) +
+				  sizeof(struct uagentbuf) + headroom + len);
+	else
+		trace = os_malloc(sizeof(struct uagentbuf_trace) +
+				  sizeof(struct uagentbuf) + headroom + len);
 	if (trace == NULL)
 		return NULL;
 	trace->magic = uagentBUF_MAGIC;
 	buf = (struct uagentbuf *) (trace + 1);
 #else /* uagent_TRACE */
-	struct uagentbuf *buf = os_zalloc(sizeof(struct uagentbuf) + len);
-	if (buf == NULL)
-		return NULL;
+	struct uagentbuf *buf = NULL;
+
+#ifdef uagentBUF_POOL
+	buf = uagentbuf_pool_get(headroom + len);
+	if (buf && zero)
+		os_memset((u8 *) (buf + 1) + headroom, 0, len);
+#endif /* uagentBUF_POOL */
+	if (buf == NULL) {
+		if (zero)
+			buf = os_zalloc(sizeof(struct uagentbuf) + headroom +
+					len);
+		else
+			buf = os_malloc(sizeof(struct uagentbuf) + headroom +
+					len);
+		if (buf == NULL)
+			return NULL;
+		buf->pool = NULL;
+	}
 #endif /* uagent_TRACE */
 
 	buf->size = len;
-	buf->buf = (u8 *) (buf + 1);
+	buf->used = 0;
+	buf->flags = 0;
+	buf->buf = (u8 *) (buf + 1) + headroom;
+	buf->shared = NULL;
+	buf->refcnt = 0;
+#ifdef uagent_TRACE
+	buf->pool = NULL;
+#endif /* uagent_TRACE */
 	return buf;
 }
 
 
+/**
+ * uagentbuf_alloc - Allocate a uagentbuf of the given size
+ * @len: Length for the allocated buffer
+ * Returns: Buffer to the allocated uagentbuf or %NULL on failure
+ */
+struct uagentbuf * uagentbuf_alloc(size_t len)
+{
+	return uagentbuf_alloc_internal(0, len, 1);
+}
+
+
+/**
+ * uagentbuf_alloc_nozero - Allocate a uagentbuf without zeroing its data
+ * @len: Length for the allocated buffer
+ * Returns: Buffer to the allocated uagentbuf or %NULL on failure
+ *
+ * For buffers that are filled with uagentbuf_put_*() right away; the data
+ * area is uninitialized. Both functions take the buffer from the pool of the
+ * calling thread if it has one of the right size class, so that only
+ * uagentbuf_alloc() pays for zeroing a recycled buffer.
+ */
+struct uagentbuf * uagentbuf_alloc_nozero(size_t len)
+{
+	return uagentbuf_alloc_internal(0, len, 0);
+}
+
+
+/**
+ * uagentbuf_alloc_headroom - Allocate a uagentbuf with room for headers
+ * @headroom: Octets reserved in front of the data for uagentbuf_push()
+ * @len: Length for the allocated buffer, not counting the headroom
+ * Returns: Buffer to the allocated uagentbuf or %NULL on failure
+ *
+ * The data area is uninitialized as with uagentbuf_alloc_nozero(). A message
+ * whose headers are only known once its payload has been built, e.g., a frame
+ * with its length, can then get them prepended in place instead of being
+ * copied behind them.
+ */
+struct uagentbuf * uagentbuf_alloc_headroom(size_t headroom, size_t len)
+{
+	return uagentbuf_alloc_internal(headroom, len, 0);
+}
+
+
 struct uagentbuf * uagentbuf_alloc_ext_data(u8 *data, size_t len)
 {
 #ifdef uagent_TRACE
@@ -159,7 +457,7 @@ struct uagentbuf * uagentbuf_alloc_ext_data(u8 *data, size_t len)
 
 struct uagentbuf * uagentbuf_alloc_copy(const void *data, size_t len)
 {
-	struct uagentbuf *buf = uagentbuf_alloc(len);
+	struct uagentbuf *buf = uagentbuf_alloc_nozero(len);
 	if (buf)
 		uagentbuf_put_data(buf, data, len);
 	return buf;
@@ -168,16 +466,105 @@ struct uagentbuf * uagentbuf_alloc_copy(const void *data, size_t len)
 
 struct uagentbuf * uagentbuf_dup(const struct uagentbuf *src)
 {
-	struct uagentbuf *buf = uagentbuf_alloc(uagentbuf_len(src));
+	struct uagentbuf *buf = uagentbuf_alloc_nozero(uagentbuf_len(src));
 	if (buf)
 		uagentbuf_put_data(buf, uagentbuf_head(src), uagentbuf_len(src));
 	return buf;
 }
 
 
+static struct uagentbuf * uagentbuf_view(struct uagentbuf *shared, u8 *data,
+					 size_t len)
+{
+	struct uagentbuf *view;
+
+	view = uagentbuf_alloc_internal(0, 0, 0);
+	if (view == NULL)
+		return NULL;
+	view->buf = data;
+	view->size = view->used = len;
+	view->shared = shared;
+	__sync_add_and_fetch(&shared->refcnt, 1);
+	return view;
+}
+
+
+/**
+ * uagentbuf_share - Make the data of a buffer shareable
+ * @buf: Buffer to share, owned by the returned view from now on
+ * Returns: Read-only view of all data in buf or %NULL on failure, in which
+ * case buf is freed
+ *
+ * Views of the same data are made with uagentbuf_clone() and uagentbuf_slice()
+ * without copying it, e.g., to queue one encoded message on several
+ * connections. The data stays allocated until the last view is freed with
+ * uagentbuf_free(); views may be freed by any thread.
+ *
+ * A view is an ordinary uagentbuf to the rest of the API, except that its
+ * data must not be modified through uagentbuf_mhead(). It has no head or tail
+ * room, so uagentbuf_put() and uagentbuf_push() overflow, and
+ * uagentbuf_resize() or uagentbuf_reserve() replace it with a private copy.
+ * uagentbuf_consume() just advances the view. If buf already is a view, it is
+ * returned as is.
+ */
+struct uagentbuf * uagentbuf_share(struct uagentbuf *buf)
+{
+	struct uagentbuf *view;
+
+	if (buf == NULL || buf->shared)
+		return buf;
+	view = uagentbuf_view(buf, buf->buf, buf->used);
+	if (view == NULL)
+		uagentbuf_free(buf);
+	return view;
+}
+
+
+/**
+ * uagentbuf_slice - Get a view of a part of shared data
+ * @view: View from uagentbuf_share(), uagentbuf_slice() or uagentbuf_clone()
+ * @offset: Offset of the part within the data of @view
+ * @len: Length of the part
+ * Returns: New view of the part or %NULL if @view is not a view, the part is
+ * out of its bounds or on allocation failure
+ */
+struct uagentbuf * uagentbuf_slice(const struct uagentbuf *view, size_t offset,
+				   size_t len)
+{
+	if (view->shared == NULL || offset > view->used ||
+	    len > view->used - offset)
+		return NULL;
+	return uagentbuf_view(view->shared, view->buf + offset, len);
+}
+
+
+/**
+ * uagentbuf_clone - Get another view of shared data
+ * @view: View from uagentbuf_share(), uagentbuf_slice() or uagentbuf_clone()
+ * Returns: New view of the same data or %NULL on failure
+ *
+ * Unlike uagentbuf_dup(), this does not copy the data.
+ */
+struct uagentbuf * uagentbuf_clone(const struct uagentbuf *view)
+{
+	return uagentbuf_slice(view, 0, uagentbuf_len(view));
+}
+
+/* Drop the reference of a view, the last one frees the shared buffer */
+static void uagentbuf_unref(struct uagentbuf *shared)
+{
+	if (__sync_sub_and_fetch(&shared->refcnt, 1) == 0)
+		uagentbuf_free(shared);
+}
+
+
+
 /**
  * uagentbuf_free - Free a uagentbuf
  * @buf: uagentbuf buffer
+ *
+ * The buffer goes back to the pool of the calling thread if it came from
+ * there and the free list of its size class is not full.
  */
 void uagentbuf_free(struct uagentbuf *buf)
 {
@@ -192,14 +579,22 @@ void uagentbuf_free(struct uagentbuf *buf)
 		uagent_trace_show("uagentbuf_free magic mismatch");
 		abort();
 	}
+	if (buf->shared)
+		uagentbuf_unref(buf->shared);
 	if (buf->flags & uagentBUF_FLAG_EXT_DATA)
 		os_free(buf->buf);
 	os_free(trace);
 #else /* uagent_TRACE */
 	if (buf == NULL)
 		return;
+	if (buf->shared)
+		uagentbuf_unref(buf->shared);
 	if (buf->flags & uagentBUF_FLAG_EXT_DATA)
 		os_free(buf->buf);
+#ifdef uagentBUF_POOL
+	if (uagentbuf_pool_put(buf) == 0)
+		return;
+#endif /* uagentBUF_POOL */
 	os_free(buf);
 #endif /* uagent_TRACE */
 }
@@ -216,6 +611,55 @@ void * uagentbuf_put(struct uagentbuf *buf, size_t len)
 }
 
 
+/**
+ * uagentbuf_push - Prepend data to a buffer
+ * @buf: uagentbuf buffer
+ * @len: Number of octets to add in front of the data
+ * Returns: Pointer to the new head of the data, to be filled in by the caller
+ *
+ * The octets are taken from the headroom, see uagentbuf_alloc_headroom();
+ * pushing more than uagentbuf_headroom() is a fatal error like overflowing
+ * uagentbuf_put().
+ */
+void * uagentbuf_push(struct uagentbuf *buf, size_t len)
+{
+	if (len > uagentbuf_headroom(buf))
+		uagentbuf_overflow(buf, len);
+	buf->buf -= len;
+	buf->used += len;
+	buf->size += len;
+	return buf->buf;
+}
+
+
+/**
+ * uagentbuf_consume - Remove data from the head of a buffer
+ * @buf: uagentbuf buffer
+ * @len: Number of octets to remove
+ *
+ * The remaining data is moved to the head of the buffer, which makes the
+ * space available as tail room again, e.g., for a stream reassembly buffer.
+ */
+void uagentbuf_consume(struct uagentbuf *buf, size_t len)
+{
+	if (buf->shared) {
+		/* A view must not write to the shared data, it just shrinks */
+		if (len > buf->used)
+			len = buf->used;
+		buf->buf += len;
+		buf->used -= len;
+		buf->size -= len;
+		return;
+	}
+	if (len >= buf->used) {
+		buf->used = 0;
+		return;
+	}
+	os_memmove(buf->buf, buf->buf + len, buf->used - len);
+	buf->used -= len;
+}
+
+
 /**
  * uagentbuf_concat - Concatenate two buffers into a newly allocated one
  * @a: First buffer
@@ -223,7 +667,9 @@ void * uagentbuf_put(struct uagentbuf *buf, size_t len)
  * Returns: uagentbuf with concatenated a + b data or %NULL on failure
  *
  * Both buffers a and b will be freed regardless of the return value. Input
- * buffers can be %NULL which is interpreted as an empty buffer.
+ * buffers can be %NULL which is interpreted as an empty buffer. This copies
+ * both buffers; data that is only going to be written out is better kept in
+ * a uagentbuf chain.
  */
 struct uagentbuf * uagentbuf_concat(struct uagentbuf *a, struct uagentbuf *b)
 {
@@ -238,7 +684,7 @@ struct uagentbuf * uagentbuf_concat(struct uagentbuf *a, struct uagentbuf *b)
 	if (b)
 		len += uagentbuf_len(b);
 
-	n = uagentbuf_alloc(len);
+	n = uagentbuf_alloc_nozero(len);
 	if (n) {
 		if (a)
 			uagentbuf_put_buf(n, a);
@@ -277,7 +723,7 @@ struct uagentbuf * uagentbuf_zeropad(struct uagentbuf *buf, size_t len)
 	if (blen >= len)
 		return buf;
 
-	ret = uagentbuf_alloc(len);
+	ret = uagentbuf_alloc_nozero(len);
 	if (ret) {
 		os_memset(uagentbuf_put(ret, len - blen), 0, len - blen);
 		uagentbuf_put_buf(ret, buf);
@@ -301,3 +747,170 @@ void uagentbuf_printf(struct uagentbuf *buf, char *fmt, ...)
 		uagentbuf_overflow(buf, res);
 	buf->used += res;
 }
+
+
+/**
+ * uagentbuf_chain_init - Initialize an empty chain
+ * @chain: Chain to initialize
+ */
+void uagentbuf_chain_init(struct uagentbuf_chain *chain)
+{
+	chain->num = 0;
+}
+
+
+/**
+ * uagentbuf_chain_clear - Free the segments of a chain
+ * @chain: Chain from uagentbuf_chain_init()
+ *
+ * The chain is empty afterwards and can be reused.
+ */
+void uagentbuf_chain_clear(struct uagentbuf_chain *chain)
+{
+	unsigned int i;
+
+	for (i = 0; i < chain->num; i++)
+		uagentbuf_free(chain->seg[i]);
+	chain->num = 0;
+}
+
+
+/**
+ * uagentbuf_chain_append - Add a segment to the end of a chain
+ * @chain: Chain from uagentbuf_chain_init()
+ * @buf: Segment, owned by the chain from now on even on failure; %NULL is
+ *	treated as an allocation failure
+ * Returns: 0 on success, -1 if buf is %NULL or the chain is full
+ */
+int uagentbuf_chain_append(struct uagentbuf_chain *chain, struct uagentbuf *buf)
+{
+	if (buf == NULL)
+		return -1;
+	if (chain->num == uagentBUF_CHAIN_MAX) {
+		uagentbuf_free(buf);
+		return -1;
+	}
+	chain->seg[chain->num++] = buf;
+	return 0;
+}
+
+
+/**
+ * uagentbuf_chain_prepend - Add a segment to the front of a chain
+ * @chain: Chain from uagentbuf_chain_init()
+ * @buf: Segment, owned by the chain from now on even on failure; %NULL is
+ *	treated as an allocation failure
+ * Returns: 0 on success, -1 if buf is %NULL or the chain is full
+ */
+int uagentbuf_chain_prepend(struct uagentbuf_chain *chain,
+			    struct uagentbuf *buf)
+{
+	if (buf == NULL)
+		return -1;
+	if (chain->num == uagentBUF_CHAIN_MAX) {
+		uagentbuf_free(buf);
+		return -1;
+	}
+	os_memmove(&chain->seg[1], &chain->seg[0],
+		   chain->num * sizeof(chain->seg[0]));
+	chain->seg[0] = buf;
+	chain->num++;
+	return 0;
+}
+
+
+/**
+ * uagentbuf_chain_push - Prepend a header to a chain
+ * @chain: Chain from uagentbuf_chain_init()
+ * @len: Length of the header
+ * Returns: Pointer to the header, to be filled in by the caller, or %NULL on
+ * failure
+ *
+ * The header goes into the headroom of the first segment if it fits there.
+ * Otherwise a new segment is prepended, with %uagentBUF_HEADROOM to spare for
+ * the headers of outer protocol layers.
+ */
+void * uagentbuf_chain_push(struct uagentbuf_chain *chain, size_t len)
+{
+	struct uagentbuf *buf;
+
+	if (chain->num && uagentbuf_headroom(chain->seg[0]) >= len)
+		return uagentbuf_push(chain->seg[0], len);
+
+	buf = uagentbuf_alloc_headroom(len + uagentBUF_HEADROOM, 0);
+	if (uagentbuf_chain_prepend(chain, buf) < 0)
+		return NULL;
+	return uagentbuf_push(buf, len);
+}
+
+
+/**
+ * uagentbuf_chain_len - Get the total length of the data in a chain
+ * @chain: Chain from uagentbuf_chain_init()
+ * Returns: Sum of the segment lengths
+ */
+size_t uagentbuf_chain_len(const struct uagentbuf_chain *chain)
+{
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < chain->num; i++)
+		len += uagentbuf_len(chain->seg[i]);
+	return len;
+}
+
+
+/**
+ * uagentbuf_chain_iovec - Describe the data of a chain for writev()
+ * @chain: Chain from uagentbuf_chain_init()
+ * @iov: Buffer for the I/O vector
+ * @max: Number of entries in iov
+ * Returns: Number of entries filled in, or -1 if iov is too short
+ *
+ * The entries point into the segments, so the chain must be kept until the
+ * I/O is done. Empty segments are skipped.
+ */
+int uagentbuf_chain_iovec(const struct uagentbuf_chain *chain,
+			  struct iovec *iov, int max)
+{
+	unsigned int i;
+	int n = 0;
+
+	for (i = 0; i < chain->num; i++) {
+		if (uagentbuf_len(chain->seg[i]) == 0)
+			continue;
+		if (n == max)
+			return -1;
+		iov[n].iov_base = uagentbuf_mhead(chain->seg[i]);
+		iov[n].iov_len = uagentbuf_len(chain->seg[i]);
+		n++;
+	}
+	return n;
+}
+
+
+/**
+ * uagentbuf_chain_flatten - Copy the data of a chain into a single buffer
+ * @chain: Chain from uagentbuf_chain_init(), empty afterwards
+ * Returns: Buffer with the data of all segments or %NULL on failure
+ *
+ * For consumers that need contiguous data. A chain of one segment is returned
+ * without copying. The segments are freed regardless of the return value.
+ */
+struct uagentbuf * uagentbuf_chain_flatten(struct uagentbuf_chain *chain)
+{
+	struct uagentbuf *buf;
+	unsigned int i;
+
+	if (chain->num == 1) {
+		chain->num = 0;
+		return chain->seg[0];
+	}
+	buf = uagentbuf_alloc_nozero(uagentbuf_chain_len(chain));
+	if (buf) {
+		for (i = 0; i < chain->num; i++)
+			uagentbuf_put_buf(buf, chain->seg[i]);
+	}
+	uagentbuf_chain_clear(chain);
+	return buf;
+}
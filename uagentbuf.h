@@ -12,6 +12,68 @@
 /* uagentbuf::buf is a pointer to external data */
 #define uagentBUF_FLAG_EXT_DATA BIT(0)
 
+/* Smallest size uagentbuf_resize() and uagentbuf_reserve() grow to */
+#define uagentBUF_MIN_GROW 64
+
+/*
+ * Headroom reserved for protocol headers by uagentbuf_alloc_headroom() users
+ * and by uagentbuf_chain_push() when it needs a new segment
+ */
+#define uagentBUF_HEADROOM 16
+/* Segments in a uagentbuf chain */
+#define uagentBUF_CHAIN_MAX 16
+
+/*
+ * Buffer pool size classes: 64 octets, doubling up to 128 kB, which holds the
+ * largest frame. Larger buffers are allocated directly. Building with
+ * CONFIG_NO_UAGENTBUF_POOL disables the pool.
+ */
+#define uagentBUF_POOL_MIN_SHIFT 6
+#define uagentBUF_POOL_CLASSES 12
+/* Free buffers kept per size class: this many octets' worth, ... */
+#define uagentBUF_POOL_CLASS_BYTES (256 * 1024)
+/* ... but at least this many buffers */
+#define uagentBUF_POOL_MIN_FREE 4
+
+struct uagentbuf_pool;
+
+struct iovec;
+
+/**
+ * struct uagentbuf_chain - Message assembled from several buffers
+ * @seg: Segments in the order of the data, owned by the chain
+ * @num: Number of segments
+ *
+ * A chain lets headers, payloads and trailers that are built separately go
+ * out with a single writev() without copying them into one buffer. Headers
+ * are best prepended with uagentbuf_chain_push(), which writes them into the
+ * headroom of the first segment when there is room. A chain is normally a
+ * local variable set up with uagentbuf_chain_init().
+ */
+struct uagentbuf_chain {
+	struct uagentbuf *seg[uagentBUF_CHAIN_MAX];
+	unsigned int num;
+};
+
+/**
+ * struct uagentbuf_pool_stats - Buffer pool statistics of a thread
+ * @hits: Allocations served from a free list
+ * @misses: Allocations of a new pool block with os_malloc()
+ * @oversize: Allocations too large for the pool
+ * @foreign: Pool buffers freed by another thread than the allocating one,
+ *	released with os_free()
+ * @cached: Buffers on the free lists
+ * @cached_bytes: Data octets of the buffers on the free lists
+ */
+struct uagentbuf_pool_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long oversize;
+	unsigned long foreign;
+	unsigned long cached;
+	size_t cached_bytes;
+};
+
 /*
  * Internal data structure for uagentbuf. Please do not touch this directly from
  * elsewhere. This is only defined in header file to allow inline functions
@@ -22,20 +84,45 @@ struct uagentbuf {
 	size_t used; /* length of data in the buffer */
 	u8 *buf; /* pointer to the head of the buffer */
 	unsigned int flags;
+	struct uagentbuf_pool *pool; /* pool of the block or %NULL */
+	unsigned int pool_class; /* size class within the pool */
+	struct uagentbuf *shared; /* buffer a view points into or %NULL */
+	unsigned int refcnt; /* views of a shared buffer */
 	/* optionally followed by the allocated buffer */
 };
 
 
 int uagentbuf_resize(struct uagentbuf **buf, size_t add_len);
+int uagentbuf_reserve(struct uagentbuf **buf, size_t add_len);
 struct uagentbuf * uagentbuf_alloc(size_t len);
+struct uagentbuf * uagentbuf_alloc_nozero(size_t len);
+struct uagentbuf * uagentbuf_alloc_headroom(size_t headroom, size_t len);
 struct uagentbuf * uagentbuf_alloc_ext_data(u8 *data, size_t len);
 struct uagentbuf * uagentbuf_alloc_copy(const void *data, size_t len);
 struct uagentbuf * uagentbuf_dup(const struct uagentbuf *src);
+struct uagentbuf * uagentbuf_share(struct uagentbuf *buf);
+struct uagentbuf * uagentbuf_slice(const struct uagentbuf *view, size_t offset,
+				   size_t len);
+struct uagentbuf * uagentbuf_clone(const struct uagentbuf *view);
 void uagentbuf_free(struct uagentbuf *buf);
 void * uagentbuf_put(struct uagentbuf *buf, size_t len);
+void * uagentbuf_push(struct uagentbuf *buf, size_t len);
+void uagentbuf_consume(struct uagentbuf *buf, size_t len);
 struct uagentbuf * uagentbuf_concat(struct uagentbuf *a, struct uagentbuf *b);
 struct uagentbuf * uagentbuf_zeropad(struct uagentbuf *buf, size_t len);
 void uagentbuf_printf(struct uagentbuf *buf, char *fmt, ...) PRINTF_FORMAT(2, 3);
+void uagentbuf_pool_get_stats(struct uagentbuf_pool_stats *stats);
+void uagentbuf_pool_trim(void);
+void uagentbuf_chain_init(struct uagentbuf_chain *chain);
+void uagentbuf_chain_clear(struct uagentbuf_chain *chain);
+int uagentbuf_chain_append(struct uagentbuf_chain *chain, struct uagentbuf *buf);
+int uagentbuf_chain_prepend(struct uagentbuf_chain *chain,
+			    struct uagentbuf *buf);
+void * uagentbuf_chain_push(struct uagentbuf_chain *chain, size_t len);
+size_t uagentbuf_chain_len(const struct uagentbuf_chain *chain);
+int uagentbuf_chain_iovec(const struct uagentbuf_chain *chain,
+			  struct iovec *iov, int max);
+struct uagentbuf * uagentbuf_chain_flatten(struct uagentbuf_chain *chain);
 
 
 /**
@@ -68,6 +155,18 @@ static inline size_t uagentbuf_tailroom(const struct uagentbuf *buf)
 	return buf->size - buf->used;
 }
 
+/**
+ * uagentbuf_headroom - Get size of available head room before the buffer data
+ * @buf: uagentbuf buffer
+ * Returns: Head room (in bytes) available to uagentbuf_push()
+ */
+static inline size_t uagentbuf_headroom(const struct uagentbuf *buf)
+{
+	if ((buf->flags & uagentBUF_FLAG_EXT_DATA) || buf->shared)
+		return 0;
+	return buf->buf - (const u8 *) (buf + 1);
+}
+
 /**
  * uagentbuf_head - Get pointer to the head of the buffer data
  * @buf: uagentbuf buffer
@@ -151,6 +250,8 @@ static inline void uagentbuf_set(struct uagentbuf *buf, const void *data, size_t
 {
 	buf->buf = (u8 *) data;
 	buf->flags = uagentBUF_FLAG_EXT_DATA;
+	buf->pool = NULL;
+	buf->shared = NULL;
 	buf->size = buf->used = len;
 }
 
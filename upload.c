@@ -0,0 +1,477 @@
+/*
+ * Batched upload of collected wifi signals
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "select.h"
+#include "uagent_debug.h"
+#include "server_cmd.h"
+#include "codec.h"
+#include "sendq.h"
+#include "spool.h"
+#include "upload.h"
+
+/*
+ * Records are queued as they are in a ring. A batch is encoded at flush time
+ * from the oldest records that share the wifi device and hotspot MAC
+ * addresses; the user device MAC addresses are interned through a small open
+ * addressing hash table that is cleared for every batch.
+ */
+struct upload {
+	struct sendq *tx; /* data channel output queue, NULL while it is down */
+	struct wifi_signal_data *ring;
+	unsigned int capacity; /* in records */
+	unsigned int head; /* index of the oldest queued record */
+	unsigned int count; /* number of queued records */
+	unsigned int batch;
+	unsigned int flush_ms;
+	struct select_timeout flush_timer; /* pending while count > 0 */
+	int failing; /* last send failed or the output queue is full, retry
+		      * from the timers or upload_resume() only */
+	unsigned long dropped;
+
+	/*
+	 * Batches that cannot be sent go to the spool, if any, and are
+	 * replayed from replay_timer. While the spool is not empty, new batches
+	 * are spooled as well to keep them in order.
+	 */
+	struct spool *spool;
+	struct select_timeout replay_timer;
+
+	/* Per-batch MAC dictionary */
+	u16 *hash; /* dictionary index + 1, 0 for an empty slot */
+	unsigned int hash_bits;
+	u16 *dict; /* batch position of the first record with each MAC */
+	u16 *index; /* dictionary index of each record in the batch */
+};
+
+
+static void upload_flush_timeout(void *server_ctx, void *uagent_ctx);
+static void upload_replay(void *server_ctx, void *uagent_ctx);
+
+
+struct upload * upload_init(struct sendq *tx, unsigned int batch_records,
+			    unsigned int flush_ms, unsigned int ring_records)
+{
+	struct upload *up;
+
+	if (batch_records == 0)
+		batch_records = UPLOAD_BATCH_RECORDS;
+	if (batch_records > UPLOAD_BATCH_MAX_RECORDS)
+		batch_records = UPLOAD_BATCH_MAX_RECORDS;
+	if (flush_ms == 0)
+		flush_ms = UPLOAD_FLUSH_MS;
+	if (ring_records == 0)
+		ring_records = UPLOAD_RING_RECORDS;
+	if (ring_records < batch_records)
+		ring_records = batch_records;
+
+	up = os_zalloc(sizeof(*up));
+	if (up == NULL)
+		return NULL;
+	/* Keep the hash table at most half full */
+	up->hash_bits = 1;
+	while ((1U << up->hash_bits) < 2 * batch_records)
+		up->hash_bits++;
+	up->ring = os_calloc(ring_records, sizeof(*up->ring));
+	up->hash = os_calloc(1U << up->hash_bits, sizeof(u16));
+	up->dict = os_calloc(batch_records, sizeof(u16));
+	up->index = os_calloc(batch_records, sizeof(u16));
+	if (up->ring == NULL || up->hash == NULL || up->dict == NULL ||
+	    up->index == NULL) {
+		os_free(up->ring);
+		os_free(up->hash);
+		os_free(up->dict);
+		os_free(up->index);
+		os_free(up);
+		return NULL;
+	}
+	up->tx = tx;
+	up->capacity = ring_records;
+	up->batch = batch_records;
+	up->flush_ms = flush_ms;
+	select_timeout_init(&up->flush_timer, upload_flush_timeout, up, NULL);
+	select_timeout_init(&up->replay_timer, upload_replay, up, NULL);
+	return up;
+}
+
+
+void upload_deinit(struct upload *up)
+{
+	if (up == NULL)
+		return;
+	upload_flush(up);
+	select_timeout_disarm(&up->flush_timer);
+	select_timeout_disarm(&up->replay_timer);
+	os_free(up->ring);
+	os_free(up->hash);
+	os_free(up->dict);
+	os_free(up->index);
+	os_free(up);
+}
+
+
+static void upload_arm(struct upload *up)
+{
+	if (up->count == 0) {
+		select_timeout_disarm(&up->flush_timer);
+		return;
+	}
+	if (!select_timeout_pending(&up->flush_timer))
+		select_timeout_arm(&up->flush_timer, up->flush_ms / 1000,
+				   (up->flush_ms % 1000) * 1000);
+}
+
+
+static const struct wifi_signal_data * upload_rec(struct upload *up,
+						  unsigned int i)
+{
+	return &up->ring[(up->head + i) % up->capacity];
+}
+
+
+static unsigned int upload_mac_hash(const u8 *mac, unsigned int bits)
+{
+	/* The OUI in the first three octets carries little entropy */
+	u32 v = uagent_GET_BE32(mac + 2);
+
+	return (v * 2654435761U) >> (32 - bits);
+}
+
+
+/* Returns the dictionary size */
+static unsigned int upload_intern(struct upload *up, unsigned int n)
+{
+	unsigned int mask = (1U << up->hash_bits) - 1;
+	unsigned int i, h, m = 0;
+	const u8 *mac;
+
+	os_memset(up->hash, 0, (mask + 1) * sizeof(u16));
+	for (i = 0; i < n; i++) {
+		mac = upload_rec(up, i)->user_dev_mac;
+		h = upload_mac_hash(mac, up->hash_bits);
+		while (up->hash[h] &&
+		       os_memcmp(upload_rec(up, up->dict[up->hash[h] - 1])->
+				 user_dev_mac, mac, ETH_ALEN) != 0)
+			h = (h + 1) & mask;
+		if (!up->hash[h]) {
+			up->dict[m] = i;
+			up->hash[h] = ++m;
+		}
+		up->index[i] = up->hash[h] - 1;
+	}
+	return m;
+}
+
+
+static s8 upload_rssi(int rssi)
+{
+	if (rssi < -128)
+		return -128;
+	if (rssi > 127)
+		return 127;
+	return rssi;
+}
+
+
+/*
+ * Encode the oldest records, at most @max, that share the wifi device and
+ * hotspot MAC addresses of the oldest one. @count is set to the number of
+ * records in the batch.
+ */
+static struct uagentbuf * upload_encode(struct upload *up, unsigned int max,
+					unsigned int *count)
+{
+	const struct wifi_signal_data *first = upload_rec(up, 0), *rec;
+	struct uagentbuf *buf;
+	unsigned int i, n, m;
+
+	for (n = 1; n < max; n++) {
+		rec = upload_rec(up, n);
+		if (os_memcmp(rec->wifi_dev_mac, first->wifi_dev_mac,
+			      ETH_ALEN) != 0 ||
+		    os_memcmp(rec->hotpot_mac, first->hotpot_mac,
+			      ETH_ALEN) != 0)
+			break;
+	}
+	/* The frame header goes into the headroom, see upload_send_batch() */
+	buf = uagentbuf_alloc_headroom(uagentBUF_HEADROOM,
+				       UPLOAD_BATCH_HDR_MAX_LEN +
+				       n * UPLOAD_RECORD_MAX_LEN);
+	if (buf == NULL)
+		return NULL;
+	m = upload_intern(up, n);
+
+	uagentbuf_put_u8(buf, CODEC_VERSION);
+	uagentbuf_put_u8(buf, CODEC_MSG_SIGNALS);
+	codec_put_varint(buf, n);
+	uagentbuf_put_data(buf, first->wifi_dev_mac, ETH_ALEN);
+	uagentbuf_put_data(buf, first->hotpot_mac, ETH_ALEN);
+	codec_put_varint(buf, first->timestamp);
+	codec_put_varint(buf, m);
+	for (i = 0; i < m; i++)
+		uagentbuf_put_data(buf, upload_rec(up, up->dict[i])->user_dev_mac,
+				   ETH_ALEN);
+	for (i = 0; i < n; i++)
+		codec_put_varint(buf, up->index[i]);
+	for (i = 1; i < n; i++)
+		codec_put_varint(buf, codec_zigzag(
+					 (s64) upload_rec(up, i)->timestamp -
+					 upload_rec(up, i - 1)->timestamp));
+	for (i = 0; i < n; i++)
+		uagentbuf_put_u8(buf, upload_rssi(upload_rec(up, i)->rssi));
+
+	*count = n;
+	return buf;
+}
+
+
+/*
+ * Schedule sending the spooled batches if the data channel is up and takes
+ * more data; a full output queue calls upload_resume() once it has drained
+ */
+static void upload_replay_arm(struct upload *up)
+{
+	unsigned int ms;
+
+	if (up->spool == NULL || spool_count(up->spool) == 0 ||
+	    up->tx == NULL || sendq_full(up->tx) ||
+	    select_timeout_pending(&up->replay_timer))
+		return;
+	/* Retry a failing channel at the flush interval */
+	ms = up->failing ? up->flush_ms : 0;
+	select_timeout_arm(&up->replay_timer, ms / 1000, (ms % 1000) * 1000);
+}
+
+
+static void upload_replay(void *server_ctx, void *uagent_ctx)
+{
+	struct upload *up = server_ctx;
+	const u8 *data;
+	unsigned int i;
+	size_t len;
+
+	/* Send a few batches per pass so that the loop stays responsive */
+	for (i = 0; i < UPLOAD_REPLAY_BURST; i++) {
+		if (sendq_full(up->tx))
+			break;
+		data = spool_peek(up->spool, &len);
+		if (data == NULL)
+			break;
+		if (frame_queue(up->tx, data, len) < 0) {
+			up->failing = 1;
+			break;
+		}
+		up->failing = 0;
+		spool_consume(up->spool);
+	}
+	if (spool_count(up->spool) == 0)
+		uagent_printf(MSG_INFO, "upload: spooled batches sent");
+	upload_replay_arm(up);
+}
+
+
+/* Send one batch of at most @max of the oldest queued records */
+static int upload_send_batch(struct upload *up, unsigned int max)
+{
+	struct uagentbuf *buf;
+	unsigned long evicted;
+	unsigned int n;
+	int direct, res;
+
+	/* Spooled batches go first to keep the order */
+	direct = up->tx && !sendq_full(up->tx) &&
+		(up->spool == NULL || spool_count(up->spool) == 0);
+	if (!direct && up->spool == NULL) {
+		/* Nowhere to put the batch, keep the records queued */
+		up->failing = 1;
+		return -1;
+	}
+	buf = upload_encode(up, max, &n);
+	if (buf == NULL) {
+		up->failing = 1;
+		return -1;
+	}
+	if (direct) {
+		/*
+		 * The queue takes the batch as it is. Should that fail, the
+		 * records stay queued and go to the spool on the next flush,
+		 * since the queue of a failed connection is full.
+		 */
+		res = frame_queue_buf(up->tx, buf);
+		up->failing = res < 0;
+	} else {
+		/* Keep the batch on disk until the data channel is back */
+		res = spool_append(up->spool, uagentbuf_head(buf),
+				   uagentbuf_len(buf));
+		evicted = spool_evicted(up->spool);
+		if (evicted)
+			uagent_printf(MSG_WARNING, "upload: spool full, %lu "
+				      "oldest batches dropped", evicted);
+		upload_replay_arm(up);
+		uagentbuf_free(buf);
+	}
+	if (res < 0)
+		return -1;
+
+	up->head = (up->head + n) % up->capacity;
+	up->count -= n;
+	if (up->dropped) {
+		uagent_printf(MSG_WARNING, "upload: %lu records were dropped "
+			      "while the data channel was failing",
+			      up->dropped);
+		up->dropped = 0;
+	}
+	return 0;
+}
+
+
+int upload_flush(struct upload *up)
+{
+	int res = 0;
+
+	while (up->count > 0) {
+		if (upload_send_batch(up, up->count < up->batch ?
+				      up->count : up->batch) < 0) {
+			res = -1;
+			break;
+		}
+	}
+	upload_arm(up);
+	return res;
+}
+
+
+static void upload_flush_timeout(void *server_ctx, void *uagent_ctx)
+{
+	upload_flush(server_ctx);
+}
+
+
+int upload_add(struct upload *up, const struct wifi_signal_data *rec)
+{
+	int res = 0;
+
+	if (up->count == up->capacity) {
+		/* Keep the newest records */
+		up->head = (up->head + 1) % up->capacity;
+		up->count--;
+		up->dropped++;
+	}
+	up->ring[(up->head + up->count) % up->capacity] = *rec;
+	up->count++;
+
+	while (up->count >= up->batch && (!up->failing || up->spool)) {
+		res = upload_send_batch(up, up->batch);
+		if (res < 0)
+			break;
+	}
+	upload_arm(up);
+	return res;
+}
+
+
+/* Skip @n varints that must all be below @limit */
+static int upload_skip_varints(const u8 **pos, const u8 *end,
+			       unsigned int n, u64 limit)
+{
+	unsigned int i;
+	u64 v;
+
+	for (i = 0; i < n; i++) {
+		if (codec_get_varint(pos, end, &v) < 0 || v >= limit)
+			return -1;
+	}
+	return 0;
+}
+
+
+void upload_set_queue(struct upload *up, struct sendq *tx)
+{
+	up->tx = tx;
+	up->failing = 0;
+	if (tx == NULL) {
+		select_timeout_disarm(&up->replay_timer);
+		return;
+	}
+	upload_replay_arm(up);
+}
+
+
+void upload_resume(struct upload *up)
+{
+	up->failing = 0;
+	upload_replay_arm(up);
+	while (up->count >= up->batch) {
+		if (upload_send_batch(up, up->batch) < 0)
+			break;
+	}
+	upload_arm(up);
+}
+
+
+void upload_set_spool(struct upload *up, struct spool *spool)
+{
+	up->spool = spool;
+	upload_replay_arm(up);
+}
+
+
+int upload_parse_batch(const u8 *data, size_t len, upload_record_cb cb,
+		       void *ctx)
+{
+	struct wifi_signal_data rec;
+	const u8 *pos, *end = data + len, *dict, *index, *delta, *rssi;
+	unsigned int i;
+	u64 n, m, v, ts;
+
+	if (len < CODEC_HDR_LEN || data[0] != CODEC_VERSION ||
+	    data[1] != CODEC_MSG_SIGNALS)
+		return -1;
+	pos = data + CODEC_HDR_LEN;
+	os_memset(&rec, 0, sizeof(rec));
+	if (codec_get_varint(&pos, end, &n) < 0 || n == 0 ||
+	    n > (size_t) (end - pos) || end - pos < 2 * ETH_ALEN)
+		return -1;
+	os_memcpy(rec.wifi_dev_mac, pos, ETH_ALEN);
+	os_memcpy(rec.hotpot_mac, pos + ETH_ALEN, ETH_ALEN);
+	pos += 2 * ETH_ALEN;
+	if (codec_get_varint(&pos, end, &ts) < 0 ||
+	    codec_get_varint(&pos, end, &m) < 0 || m == 0 || m > n ||
+	    m * ETH_ALEN > (size_t) (end - pos))
+		return -1;
+	dict = pos;
+	pos += m * ETH_ALEN;
+
+	/* Locate the columns and validate them before reporting any record */
+	index = pos;
+	if (upload_skip_varints(&pos, end, n, m) < 0)
+		return -1;
+	delta = pos;
+	if (upload_skip_varints(&pos, end, n - 1, (u64) -1) < 0)
+		return -1;
+	rssi = pos;
+	if ((size_t) (end - rssi) != n)
+		return -1;
+	if (cb == NULL)
+		return n;
+
+	for (i = 0; i < n; i++) {
+		codec_get_varint(&index, end, &v);
+		os_memcpy(rec.user_dev_mac, dict + v * ETH_ALEN, ETH_ALEN);
+		if (i > 0) {
+			codec_get_varint(&delta, end, &v);
+			ts += codec_unzigzag(v);
+		}
+		rec.timestamp = ts;
+		rec.rssi = (s8) rssi[i];
+		cb(ctx, &rec);
+	}
+	return n;
+}
@@ -0,0 +1,155 @@
+/*
+ * Batched upload of collected wifi signals
+ * Copyright (c) 2015-2020, Brad Han <bingzhehan@gmail.com>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * This file defines the data channel pipeline for struct wifi_signal_data
+ * records. Records are queued in a ring buffer as they are collected and
+ * sent in compact batches, either when a batch is full or when the oldest
+ * record has waited for the flush interval, so that the socket sees one
+ * writev() per batch instead of one write per probe sighting. Batches are
+ * handed to the output queue of the data channel, see sendq.h, and held back
+ * while it is above its high water mark.
+ */
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "framing.h"
+#include "codec.h"
+
+struct wifi_signal_data;
+struct upload;
+struct spool;
+struct sendq;
+
+/*
+ * Batch message, sent as one frame on the data channel. The records of a
+ * batch share the wifi device and hotspot MAC addresses, which are sent once,
+ * and the rest is stored column by column:
+ *   u8 version (CODEC_VERSION)
+ *   u8 message type (CODEC_MSG_SIGNALS)
+ *   varint number of records n
+ *   6 octets wifi device MAC address
+ *   6 octets hotspot MAC address
+ *   varint timestamp of the first record
+ *   varint number of distinct user device MAC addresses m
+ *   m * 6 octets user device MAC addresses in order of first appearance
+ *   n * varint index of the user device MAC address of each record
+ *   (n - 1) * zigzag varint timestamp difference to the previous record
+ *   n * s8 RSSI, clamped to -128..127
+ *
+ * Varints are encoded as in codec.h.
+ */
+#define UPLOAD_BATCH_HDR_MAX_LEN (CODEC_HDR_LEN + 3 + 2 * ETH_ALEN + 5 + 3)
+/* Dictionary entry, 2-octet index, 5-octet timestamp difference and RSSI */
+#define UPLOAD_RECORD_MAX_LEN (ETH_ALEN + 2 + 5 + 1)
+#define UPLOAD_BATCH_MAX_RECORDS \
+	((FRAME_MAX_LEN - UPLOAD_BATCH_HDR_MAX_LEN) / UPLOAD_RECORD_MAX_LEN)
+
+/* Defaults for upload_init() */
+#define UPLOAD_BATCH_RECORDS 256
+#define UPLOAD_FLUSH_MS 1000
+#define UPLOAD_RING_RECORDS 4096
+
+/* Spooled batches sent per select loop pass while replaying */
+#define UPLOAD_REPLAY_BURST 16
+
+/**
+ * upload_record_cb - Callback for a record parsed from a batch
+ * @ctx: Callback context data from upload_parse_batch()
+ * @rec: Record, valid only during the call
+ */
+typedef void (*upload_record_cb)(void *ctx,
+				 const struct wifi_signal_data *rec);
+
+/**
+ * upload_init - Set up the upload pipeline for a data channel
+ * @tx: Output queue of the data channel or %NULL if it is not connected
+ * @batch_records: Records per batch or 0 for %UPLOAD_BATCH_RECORDS, limited
+ *	to %UPLOAD_BATCH_MAX_RECORDS
+ * @flush_ms: Longest time a record waits before it is sent, or 0 for
+ *	%UPLOAD_FLUSH_MS
+ * @ring_records: Ring buffer capacity in records or 0 for
+ *	%UPLOAD_RING_RECORDS, at least one batch
+ * Returns: Pointer to the pipeline or %NULL on failure
+ *
+ * The pipeline uses the select loop of the calling thread for the flush
+ * timer and must only be used from that thread.
+ */
+struct upload * upload_init(struct sendq *tx, unsigned int batch_records,
+			    unsigned int flush_ms, unsigned int ring_records);
+
+/**
+ * upload_deinit - Flush what is buffered and free the pipeline
+ * @up: Pipeline from upload_init() or %NULL
+ *
+ * The output queue is not freed.
+ */
+void upload_deinit(struct upload *up);
+
+/**
+ * upload_add - Queue a record for upload
+ * @up: Pipeline from upload_init()
+ * @rec: Record to send
+ * Returns: 0 on success, -1 if a full batch could not be sent
+ *
+ * The record is serialized into the ring buffer; a batch is sent as soon as
+ * enough records are queued. Batches that cannot be sent, including while the
+ * output queue is full, go to the spool if one is set. Without a spool, they
+ * are only retried from the flush timer or upload_resume(), and if the ring
+ * fills up meanwhile, the oldest record is dropped to make room.
+ */
+int upload_add(struct upload *up, const struct wifi_signal_data *rec);
+
+/**
+ * upload_flush - Send all queued records now
+ * @up: Pipeline from upload_init()
+ * Returns: 0 on success, -1 on failure; unsent records stay queued
+ */
+int upload_flush(struct upload *up);
+
+/**
+ * upload_set_queue - Change the data channel output queue
+ * @up: Pipeline from upload_init()
+ * @tx: Output queue of the data channel or %NULL if it is down
+ *
+ * While the data channel is down, batches go to the spool or stay queued.
+ * Spooled batches are sent, oldest first and ahead of new batches, once a
+ * queue is set again.
+ */
+void upload_set_queue(struct upload *up, struct sendq *tx);
+
+/**
+ * upload_resume - Resume sending after backpressure
+ * @up: Pipeline from upload_init()
+ *
+ * To be called from the drained callback of the output queue, see
+ * sendq_init(). Spooled and full batches are sent again.
+ */
+void upload_resume(struct upload *up);
+
+/**
+ * upload_set_spool - Set the spool for batches that cannot be sent
+ * @up: Pipeline from upload_init()
+ * @spool: Spool from spool_open() or %NULL; it is not closed by
+ *	upload_deinit()
+ *
+ * Batches left in the spool by a previous run are sent first.
+ */
+void upload_set_spool(struct upload *up, struct spool *spool);
+
+/**
+ * upload_parse_batch - Parse a batch message
+ * @data: Frame payload
+ * @len: Length of the payload
+ * @cb: Callback for each record
+ * @ctx: Callback context data
+ * Returns: Number of records or -1 if the message is not a valid batch
+ */
+int upload_parse_batch(const u8 *data, size_t len, upload_record_cb cb,
+		       void *ctx);
+
+#endif /* UPLOAD_H */